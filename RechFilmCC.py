@@ -1,10 +1,11 @@
 from tkinter import *
 from threading import Thread
 from db import DB
-from subprocess import Popen
+from subprocess import Popen, PIPE
 import sys
 import argparse
 import os
+import re
 
 def gui():
     win = Tk()
@@ -14,8 +15,34 @@ def gui():
     bStart.pack()
     win.mainloop()
     
+class Search:
+    """Client of the search engine (py/search) over a snapshot of movies.txt
+    (split --snapshot FILE): one process answers every query, through pipes."""
+
+    def __init__(self, snapshot, program=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'py', 'search')):
+        self.process = Popen([program, snapshot], stdin=PIPE, stdout=PIPE, encoding='utf-8')
+
+    def query(self, *words):
+        # Results are tab-separated lines, up to an empty line
+        self.process.stdin.write(' '.join(words).replace('\n', ' ') + '\n')
+        self.process.stdin.flush()
+        resultat = []
+        for line in self.process.stdout:
+            line = line.rstrip('\n')
+            if not line:
+                break
+            resultat.append(tuple(line.split('\t')))
+        return resultat
+
+    def close(self):
+        self.process.stdin.close()
+        self.process.wait()
+
 def recherche_id(_id, db):
     print('\nRecherche par id :')
+    if isinstance(db, Search):
+        print(db.query('id', str(_id)))
+        return
     #db = DB(username="root", password="root", hostname="localhost", dbtype="mysql", dbname="movies")
     #print(db.tables)
     #print(db.find_column("id"))
@@ -26,11 +53,56 @@ def recherche_id(_id, db):
     
     print(resultat)
 
+def folded(c):
+    """Whether the search engine ignores the case of a character as the regex
+    does: uncased characters, ASCII and Latin-1 letters (see py/trigram.h)."""
+    return c.lower() == c.upper() or c < '\x80' or ('\xc0' <= c <= '\xfe' and c not in '\xd7\xdf')
+
+def like(pattern):
+    """Translate a LIKE pattern ('%', '_' and '\\' escapes) into a regular
+    expression matching whole titles, ignoring case as MySQL does, along with
+    its longest literal part made of characters the engine folds."""
+    regex, literal, literals = '', '', []
+    chars = iter(pattern)
+    for c in chars:
+        if c in '%_':
+            regex += '.*' if c == '%' else '.'
+            literals.append(literal)
+            literal = ''
+            continue
+        if c == '\\':
+            c = next(chars, c)
+        regex += re.escape(c)
+        if folded(c):
+            literal += c
+        else:
+            literals.append(literal)
+            literal = ''
+    literals.append(literal)
+    return re.compile(regex, re.IGNORECASE | re.DOTALL), max(literals, key=len)
+
 def recherche_title(_title, db):
     print(_title)
+    if isinstance(db, Search):
+        # LIKE patterns, plain titles included so that case is ignored: the
+        # titles containing the longest literal part, through the trigram
+        # index, then checked against the whole pattern
+        regex, literal = like(_title)
+        print([movie for movie in db.query('title-contains', literal) if regex.fullmatch(movie[1])])
+        return
     
     resultat = db.query("SELECT id, title FROM movie WHERE title LIKE '" + _title + "';")
     print(resultat)
+
+def recherche_personne(role, person, db):
+    # Movies of an actor or a director, by person id or full name
+    print('\nRecherche par ' + role + ' :')
+    print(db.query(role, person))
+
+def recherche_nom(name, db):
+    print('\nRecherche par nom :')
+    print(db.query('name-contains', name))
+
 def git():
     try:
         print("Save to github")
@@ -40,7 +112,7 @@ def git():
     except FileNotFoundError:
         print("Save Failed - File save.bat not found")
     
-def check_args(db):
+def check_args():
     parser = argparse.ArgumentParser(description='RechFilmCC # Recherche de films', usage = '%(prog)s [--options]')
     #Create a --gui option to execute gui() function #
     parser.add_argument('-g', '--gui', action="store_true",
@@ -53,7 +125,13 @@ def check_args(db):
                         help='Recherche par titre')
     #Create a --actor option to execute recherche_actor() function #
     parser.add_argument('--actor', 
-                        help='Recherche par titre')
+                        help='Recherche par acteur (id ou nom)')
+    #Create a --director option to execute recherche_personne() function #
+    parser.add_argument('--director', 
+                        help='Recherche par realisateur (id ou nom)')
+    #Create a --name option to execute recherche_nom() function #
+    parser.add_argument('--name', 
+                        help='Recherche de personnes par nom partiel')
     #Create a --budget option to execute recherche_budget() function #
     parser.add_argument('--budget', 
                         help='Recherche par titre')                    
@@ -63,19 +141,41 @@ def check_args(db):
     #Create a --git option to execute git() function # => push to gitHub https://github.com/Marcotty/RENNEQUINEPOLIS.git
     parser.add_argument('--git', action="store_true",
                         help='Save to github')                  
+    #Create a --snapshot option to search a snapshot instead of the database #
+    parser.add_argument('--snapshot', 
+                        help='Recherche dans un snapshot (split --snapshot FILE) au lieu de la base'
+                             ' (titres sans tenir compte de la casse, comme LIKE)')
     args = parser.parse_args()
+    db = None
+    if args.snapshot:
+        db = Search(args.snapshot)
+    elif args.id or args.title:
+        db = DB(username="root", password="root", hostname="localhost", dbtype="mysql", dbname="movies")
     if args.gui:
         thread_gui = ThreadGui()
         thread_gui.start()
         #thread_gui.join()
-    if args.id:
-        recherche_id(args.id, db)
-    elif args.title:
-        recherche_title(args.title, db)
-    elif args.git:
-        git()
-    else:
-        print("#No args passed")
+    try:
+        if args.id:
+            recherche_id(args.id, db)
+        elif args.title:
+            recherche_title(args.title, db)
+        elif (args.actor or args.director or args.name) and not args.snapshot:
+            print("#--actor, --director et --name demandent --snapshot")
+        elif args.actor:
+            recherche_personne('actor', args.actor, db)
+        elif args.director:
+            recherche_personne('director', args.director, db)
+        elif args.name:
+            recherche_nom(args.name, db)
+        elif args.git:
+            git()
+        else:
+            print("#No args passed")
+    finally:
+        # Stop the search engine, even if a query failed
+        if isinstance(db, Search):
+            db.close()
 
 class ThreadGui(Thread):
 
@@ -90,9 +190,8 @@ class ThreadGui(Thread):
 print('#' * 30)
 print('# Start app')
 # Check command line arguments: --gui --db
-db = DB(username="root", password="root", hostname="localhost", dbtype="mysql", dbname="movies")
 
-check_args(db)
+check_args()
 print('\n# Fin app') 
 #while(1):
  #   command = input('>>> ')
@@ -0,0 +1,279 @@
+/**
+ * bench.cpp
+ *
+ * DESCRIPTION
+ *
+ * Micro-benchmarks of the split.cpp stages over a movies.txt corpus (see
+ * genmovies.py), which is included as a whole without its entry point:
+ *
+ *	g++ -std=c++17 -O2 -pthread -o bench bench.cpp
+ *	./bench movies.txt > micro.json
+ *
+ * Every benchmark runs a stage over the whole corpus repeatedly, for at least
+ * a given time, and the best run is kept. Results are written as a JSON array
+ * of { name, runs, seconds, items, ns_per_item, mb_per_s } objects, where the
+ * items are lines or rows and the throughput refers to the corpus size. The
+ * bench.py driver collects them along with end-to-end measures.
+ *
+ * LICENSING
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#define SPLIT_NO_MAIN
+#include "split.cpp"
+
+#include <chrono>
+#include <deque>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+/**
+ * \brief Benchmark runner
+ *
+ * Times a function over the corpus until a minimum total time has elapsed and
+ * prints the best run as a JSON object.
+ */
+struct bench
+{
+	std::size_t corpus_bytes;
+	double min_time = 0.5;
+	bool first = true;
+
+	template <typename Function>
+	void run(const char* name, std::size_t items, Function&& f);
+};
+
+// Keep the compiler from optimizing away the benchmarked work
+static volatile std::size_t sink;
+
+template <typename Function>
+void bench::run(const char* name, std::size_t items, Function&& f)
+{
+	typedef std::chrono::steady_clock clock;
+
+	double best = 0, total = 0;
+	std::size_t runs = 0;
+	while (total < min_time || runs < 3)
+	{
+		const auto start = clock::now();
+		f();
+		const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+		if (!runs++ || seconds < best) best = seconds;
+		total += seconds;
+	}
+
+	std::printf("%s\n  { \"name\": \"%s\", \"runs\": %zu, \"seconds\": %.6f, \"items\": %zu,"
+		" \"ns_per_item\": %.1f, \"mb_per_s\": %.1f }",
+		first ? "[" : ",", name, runs, best, items,
+		items ? best * 1e9 / items : 0.0, corpus_bytes / best / 1e6);
+	std::fflush(stdout);
+	first = false;
+}
+
+/// Rows of all tables, split beforehand to time insertions alone
+struct rows
+{
+	std::deque<std::string> genres;
+	std::vector<schema::row<schema::movies>> movies;
+	std::vector<schema::row<schema::people>> people;
+	std::vector<schema::row<schema::directors>> directors;
+	std::vector<schema::row<schema::characters>> characters;
+
+	std::size_t size() const
+	{ return movies.size() + people.size() + directors.size() + characters.size(); }
+};
+
+/// Insert all rows with a given formatter, then flush
+template <typename Database>
+void insert_all(Database& db, const rows& r)
+{
+	for (const auto& row: r.movies) db.template insert<schema::movies>(row);
+	for (const auto& row: r.people) db.template insert<schema::people>(row);
+	for (const auto& row: r.directors) db.template insert<schema::directors>(row);
+	for (const auto& row: r.characters) db.template insert<schema::characters>(row);
+	db.flush();
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		if (argc < 2) throw std::invalid_argument("corpus file expected");
+
+		// Load all lines from the mapped corpus
+		line_reader input(argv[1]);
+		std::vector<std::string_view> lines;
+		std::size_t bytes = 0;
+		for (std::string_view line; input.next(line); bytes += line.size() + 1)
+			lines.push_back(line);
+
+		bench b{bytes};
+		if (argc > 2) b.min_time = std::strtod(argv[2], nullptr);
+
+		// Split stages
+		b.run("splitter", lines.size(), [&]()
+		{
+			std::size_t n = 0;
+			for (const auto line: lines)
+				for (splitter it(line, movie_delimiter); it.begin < it.record.size(); it++)
+					n += (*it).size();
+			sink = n;
+		});
+
+		structure index;
+		b.run("structure::build", lines.size(), [&]()
+		{
+			std::size_t n = 0;
+			for (const auto line: lines)
+			{
+				index.build(line);
+				n += index.bits.size();
+			}
+			sink = n;
+		});
+
+		record movie{raw_movie_fields};
+		b.run("record::parse", lines.size(), [&]()
+		{
+			std::size_t n = 0;
+			for (const auto line: lines) n += movie.parse(line, movie_delimiter);
+			sink = n;
+		});
+
+		b.run("record::parse/indexed", lines.size(), [&]()
+		{
+			std::size_t n = 0;
+			for (const auto line: lines)
+			{
+				index.build(line);
+				n += movie.parse(index, line, structure::movie_level);
+			}
+			sink = n;
+		});
+
+		// Whole lines, down to the values of every genre, director and actor
+		record genre(raw_genre_fields), director(raw_director_fields), actor(raw_actor_fields);
+		b.run("split/nested", lines.size(), [&]()
+		{
+			std::size_t n = 0;
+			for (const auto line: lines)
+			{
+				movie.parse(line, movie_delimiter);
+				for (const auto& [f, r]: { std::pair{ -3, &genre }, { -2, &director }, { -1, &actor } })
+					for (splitter it(movie[f], record_delimiter); it.begin < it.record.size();)
+						n += r->parse(*it++, value_delimiter);
+			}
+			sink = n;
+		});
+
+		b.run("split/nested-indexed", lines.size(), [&]()
+		{
+			std::size_t n = 0;
+			for (const auto line: lines)
+			{
+				index.build(line);
+				movie.parse(index, line, structure::movie_level);
+				for (const auto& [f, r]: { std::pair{ -3, &genre }, { -2, &director }, { -1, &actor } })
+					for (indexed_splitter it(index, movie[f], structure::record_level); it.begin < it.record.size();)
+						n += r->parse(index, *it++, structure::value_level);
+			}
+			sink = n;
+		});
+
+		// Genre sets, from the prebuilt index of every line
+		std::vector<structure> indexes(lines.size());
+		std::vector<record::field> genre_fields;
+		for (std::size_t i = 0; i < lines.size(); i++)
+		{
+			indexes[i].build(lines[i]);
+			movie.parse(indexes[i], lines[i], structure::movie_level);
+			genre_fields.push_back(movie[-3]);
+		}
+
+		std::size_t unknown = 0;
+		b.run("genres", lines.size(), [&]()
+		{
+			std::uint32_t n = 0;
+			for (std::size_t i = 0; i < lines.size(); i++)
+				n ^= genres(indexes[i], genre_fields[i], unknown);
+			sink = n;
+		});
+
+		// Rows of every table, genres as comma-separated lists
+		rows r;
+		for (std::size_t i = 0; i < lines.size(); i++)
+		{
+			const structure& x = indexes[i];
+			movie.parse(x, lines[i], structure::movie_level);
+
+			std::pmr::string set;
+			genre_set::join(genres(x, movie[-3], unknown), set);
+			movie[-3].value = r.genres.emplace_back(set);
+
+			auto& m = r.movies.emplace_back();
+			for (std::size_t f = 0; f < m.size(); f++) m[f] = movie[f].value;
+
+			for (indexed_splitter it(x, movie[-2], structure::record_level); it.begin < it.record.size();)
+			{
+				director.parse(x, *it++, structure::value_level);
+				r.people.push_back({ director[0].value, director[1].value });
+				r.directors.push_back({ movie[0].value, director[0].value });
+			}
+			for (indexed_splitter it(x, movie[-1], structure::record_level); it.begin < it.record.size();)
+			{
+				actor.parse(x, *it++, structure::value_level);
+				r.people.push_back({ actor[0].value, actor[1].value });
+				r.characters.push_back({ movie[0].value, actor[0].value, actor[2].value });
+			}
+		}
+		indexes.clear();
+
+		// Insertions into a null device, per formatter
+		writer out("/dev/null");
+		const auto run_insert = [&](const char* name, auto&& db)
+		{
+			b.run(name, r.size(), [&]() { insert_all(db, r); });
+		};
+
+		run_insert("insert/mysql", MySQL(out));
+		run_insert("insert/postgres", PostgreSQL(out));
+
+		MySQL batched(out);
+		batched.batch_rows = 1000;
+		run_insert("insert/mysql-batch", batched);
+
+		run_insert("insert/copy", PgCopy(out));
+
+		char directory[] = "/tmp/benchXXXXXX";
+		if (!::mkdtemp(directory)) throw std::system_error(errno, std::generic_category(), "mkdtemp");
+		run_insert("insert/copy-binary", PgCopy(out, directory));
+		run_insert("insert/bulk-mysql", BulkFiles(out, BulkFiles::mysql, directory));
+		std::filesystem::remove_all(directory);
+
+		std::printf("\n]\n");
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << argv[0] << " : " << e.what()
+			<< "\n\nSyntax: " << argv[0] << " CORPUS [MIN_SECONDS]\n";
+		return EXIT_FAILURE;
+	}
+}
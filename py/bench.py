@@ -0,0 +1,163 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  bench.py
+#
+#  Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+
+"""
+===========================================
+Benchmark suite
+===========================================
+
+	bench.py --lines 100000 --output results.json
+
+Builds split.cpp, csplit.c and the micro-benchmarks (bench.cpp) with the
+compilers from the CC and CXX environment variables (gcc and g++ by default),
+generates a seeded corpus (see genmovies.py, whose settings are accepted here
+too) and writes the results as JSON:
+
+ * "corpus": the generator settings, line count and size
+ * "micro": the per-stage results of bench.cpp
+ * "end_to_end": the best and median wall-clock times of split.cpp (several
+   modes), csplit.c and split.py over the corpus, with lines/s and MB/s
+
+Two result files of the same corpus settings can be compared run by run.
+"""
+
+import os
+import sys
+import json
+import time
+import shutil
+import argparse
+import platform
+import statistics
+import subprocess
+import tempfile
+
+import genmovies
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+def arguments(argv=None):
+	""" Parse the command line: bench settings, then generator settings """
+	parser = argparse.ArgumentParser(description='Benchmark the movies.txt importers.')
+	parser.add_argument('--output', help='JSON result file (default: stdout)')
+	parser.add_argument('--repeat', type=int, default=5, help='end-to-end runs per command')
+	parser.add_argument('--min-time', type=float, default=0.5,
+		help='minimum time per micro-benchmark, in seconds')
+	parser.add_argument('--build', help='build directory (default: temporary)')
+	parser.add_argument('--skip-python', action='store_true', help="don't run split.py")
+	settings, rest = parser.parse_known_args(argv)
+	return settings, genmovies.arguments(rest)
+
+def build(directory):
+	""" Compile the programs, return their paths """
+	cc = os.environ.get('CC', 'gcc')
+	cxx = os.environ.get('CXX', 'g++')
+	flags = ['-O2', '-pthread']
+	targets = {
+		'split': [cxx, '-std=c++17'] + flags + ['-o', None, 'split.cpp'],
+		'bench': [cxx, '-std=c++17'] + flags + ['-o', None, 'bench.cpp'],
+		'csplit': [cc] + flags + ['-o', None, 'csplit.c'],
+	}
+	paths = {}
+	for name, command in targets.items():
+		paths[name] = os.path.join(directory, name)
+		command[command.index(None)] = paths[name]
+		subprocess.run(command, cwd=HERE, check=True)
+	return paths
+
+def measure(command, corpus, repeat, **kwargs):
+	""" Run a command with the corpus as input, return its wall-clock times """
+	times = []
+	for i in range(repeat):
+		with open(corpus, 'rb') as input:
+			start = time.perf_counter()
+			subprocess.run(command, stdin=input, stdout=subprocess.DEVNULL,
+				stderr=subprocess.DEVNULL, check=True, **kwargs)
+			times.append(time.perf_counter() - start)
+	return times
+
+def end_to_end(paths, corpus, lines, size, settings):
+	""" Time every importer over the corpus """
+	commands = [
+		('split --mysql', [paths['split'], '--mysql', '--input', corpus]),
+		('split --postgres', [paths['split'], '--postgres', '--input', corpus]),
+		('split --copy', [paths['split'], '--copy', '--input', corpus]),
+		('split --mysql --batch 1000', [paths['split'], '--mysql', '--batch', '1000', '--input', corpus]),
+		('split --mysql (stdin)', [paths['split'], '--mysql']),
+		('csplit', [paths['csplit']]),
+	]
+	threads = os.cpu_count() or 1
+	if threads > 1:
+		commands.append(('split --mysql -j %d' % threads,
+			[paths['split'], '--mysql', '-j', str(threads), '--input', corpus]))
+	if not settings.skip_python:
+		commands.append(('split.py --mysql', [sys.executable, os.path.join(HERE, 'split.py'), '--mysql', 'movies']))
+
+	results = []
+	for name, command in commands:
+		times = measure(command, corpus, settings.repeat, cwd=HERE)
+		best = min(times)
+		results.append({
+			'name': name,
+			'runs': len(times),
+			'best_seconds': round(best, 6),
+			'median_seconds': round(statistics.median(times), 6),
+			'lines_per_s': round(lines / best, 1),
+			'mb_per_s': round(size / best / 1e6, 1),
+		})
+		print('%-30s %8.3f s %10.1f MB/s' % (name, best, size / best / 1e6), file=sys.stderr)
+	return results
+
+def main(argv=None):
+	settings, corpus_settings = arguments(argv)
+	directory = settings.build or tempfile.mkdtemp(prefix='bench')
+	try:
+		os.makedirs(directory, exist_ok=True)
+		paths = build(directory)
+
+		corpus = os.path.join(directory, 'movies.txt')
+		with open(corpus, 'w', encoding='utf-8') as output:
+			genmovies.generate(corpus_settings, output)
+		size = os.path.getsize(corpus)
+
+		micro = json.loads(subprocess.run([paths['bench'], corpus, str(settings.min_time)],
+			stdout=subprocess.PIPE, check=True).stdout)
+
+		results = {
+			'host': { 'machine': platform.machine(), 'cpus': os.cpu_count(),
+				'system': platform.system(), 'release': platform.release() },
+			'corpus': dict(vars(corpus_settings), bytes=size),
+			'micro': micro,
+			'end_to_end': end_to_end(paths, corpus, corpus_settings.lines, size, settings),
+		}
+
+		if settings.output:
+			with open(settings.output, 'w') as output:
+				json.dump(results, output, indent=2)
+		else:
+			json.dump(results, sys.stdout, indent=2)
+	finally:
+		if not settings.build:
+			shutil.rmtree(directory)
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -26,8 +26,20 @@ en charge sont:
 
  * MySQL
  * PostgreSQL
+
+Si l'extension _split est compilée (voir splitmodule.c), les instructions
+INSERT sont formatées par la bibliothèque de split.cpp, dans sa syntaxe: les
+genres inconnus sont alors ignorés, et un SET MySQL est écrit sous forme
+numérique.
 """
 
+import sys
+
+try:
+	import _split
+except ImportError:
+	_split = None
+
 def escape(v):
 	""" Escape single quotes by just doubling them as per SQL requirements """
 	return v.replace("'", "''")
@@ -49,15 +61,21 @@ def write(*args, **kwargs):
 class MySQL(object):
 	def __init__(self, db_name):
 		write('USE', db_name)
+		self.native = _split.Formatter('mysql') if _split else None
 
 	def list(self, iterable):
 		""" Make a MySQL SET from a list of values. Note that SET field type
 		values my not contain spaces after the separating comma! """
+		if self.native:
+			return self.native.genres(iterable)
 		return ','.join(iterable)
 
 	def insert(self, table_name, record_tuple):
 		""" Dump a single record as INSERT <table> (<fields>) VALUES(...)
 		while ignoring duplicates. MySQL syntax is 'INSERT IGNORE' """
+		if self.native:
+			sys.stdout.write(self.native.insert(table_name, record_tuple))
+			return
 		fields = filter_record(record_tuple)
 		write('INSERT IGNORE', table_name,
 			'(', ', '.join(fields.keys()), ')',
@@ -69,16 +87,22 @@ class Postgres(object):
 	def __init__(self, db_name = None):
 		if db_name:
 			write('\\c', db_name)
+		self.native = _split.Formatter('postgres') if _split else None
 
 	def list(self, iterable):
 		""" Make a PostgreSQL array from a list of values. Note: values are all
 		ENUM types and don't require quoting. """
+		if self.native:
+			return self.native.genres(iterable)
 		return '{' + ','.join(iterable) + '}'
 
 	def insert(self, table_name, record_tuple):
 		""" Dump a single record as INSERT <table> (<fields>) VALUES(...)
 		while ignoring duplicates. PostgerSQL syntax is 'INSERT ... ON CONFLICT
 		DO NOTHING' to skip duplicates """
+		if self.native:
+			sys.stdout.write(self.native.insert(table_name, record_tuple))
+			return
 		fields = filter_record(record_tuple)
 		write('INSERT INTO', table_name,
 			'(', ', '.join(fields.keys()), ')',
@@ -0,0 +1,400 @@
+/*
+ * decode.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#ifdef SPLIT_GZIP
+#include <zlib.h>			// Gzip input (-lz)
+#endif
+
+#ifdef SPLIT_ZSTD
+#include <zstd.h>			// Zstandard input (-lzstd)
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#endif
+
+/**
+ * \brief Compressed input data
+ *
+ * The bytes of a compressed file, either all at once if mapped, or read in
+ * blocks from a file descriptor (after the bytes already read from it to
+ * recognize the format).
+ */
+class compressed_input
+{
+public:
+	explicit compressed_input(std::string_view mapped) : pending(mapped), fd(-1) {}
+
+	compressed_input(int _fd, std::string_view prefix) : buffer(prefix), pending(buffer), fd(_fd) {}
+
+	compressed_input(compressed_input&& i) :
+		buffer(std::move(i.buffer)), pending(i.pending), fd(i.fd)
+	{
+		// Pending bytes of a moved buffer
+		if (fd >= 0) pending = std::string_view(buffer).substr(buffer.size() - i.pending.size());
+	}
+
+	// Whether the input is a mapped file
+	bool mapped() const { return fd < 0; }
+
+	// Fetch the next bytes, valid until the next call: return false at the
+	// end of the input
+	bool next(std::string_view& bytes);
+
+private:
+	static constexpr std::size_t block_size = 1 << 20;
+
+	std::string buffer;
+	std::string_view pending;
+	int fd;
+};
+
+inline bool compressed_input::next(std::string_view& bytes)
+{
+	if (!pending.empty())
+	{
+		bytes = pending;
+		pending = {};
+		return true;
+	}
+	if (fd < 0) return false;
+
+	buffer.resize(block_size);
+	ssize_t n;
+	do n = ::read(fd, buffer.data(), buffer.size());
+	while (n < 0 && errno == EINTR);
+	if (n < 0) throw std::system_error(errno, std::generic_category(), "read");
+
+	bytes = { buffer.data(), std::size_t(n) };
+	return n > 0;
+}
+
+/**
+ * \brief Input decoder
+ *
+ * Decompresses gzip or zstd input, recognized by its magic number, straight
+ * into the buffer of the line reader (see line_reader::fill) as read(2) would
+ * fill it: lines point into decompressed data which is never copied again.
+ *
+ * Support for each format is built in with its library:
+ *
+ *	g++ -std=c++17 -O2 -pthread -DSPLIT_GZIP -DSPLIT_ZSTD -o split split.cpp -lz -lzstd
+ */
+class decoder
+{
+public:
+	virtual ~decoder() = default;
+
+	// Decompress up to n bytes, return their number or 0 at the end
+	virtual std::size_t read(char* out, std::size_t n) = 0;
+
+	// Minimum room to read into
+	virtual std::size_t block() const { return 1 << 20; }
+
+	// Return the decoder of compressed input, or null if not compressed
+	static std::unique_ptr<decoder> open(compressed_input&& input, std::string_view head);
+
+	// Whether the first bytes of the input may begin a magic number yet to
+	// be read whole, i.e. more bytes are needed to tell
+	static bool partial(std::string_view head)
+	{
+		const auto begins = [&](std::string_view magic)
+		{ return head.size() < magic.size() && magic.substr(0, head.size()) == head; };
+		return begins(gzip_magic) || begins(zstd_magic);
+	}
+
+	static constexpr std::string_view gzip_magic{"\x1f\x8b", 2}, zstd_magic{"\x28\xb5\x2f\xfd", 4};
+};
+
+#ifdef SPLIT_GZIP
+/**
+ * \brief Gzip decoder
+ *
+ * zlib inflate over large buffers. Concatenated gzip members (e.g. parallel
+ * compressors' output) are decoded one after another.
+ */
+class gzip_decoder : public decoder
+{
+public:
+	explicit gzip_decoder(compressed_input&& _input) : input(std::move(_input))
+	{
+		if (inflateInit2(&z, 15 + 16) != Z_OK) throw std::runtime_error("gzip: initialization failed");
+	}
+
+	~gzip_decoder() { inflateEnd(&z); }
+
+	std::size_t read(char* out, std::size_t n);
+
+private:
+	compressed_input input;
+	z_stream z{};
+
+	// Whether a member is being decoded
+	bool member = false;
+};
+
+inline std::size_t gzip_decoder::read(char* out, std::size_t n)
+{
+	z.next_out = reinterpret_cast<Bytef*>(out);
+	z.avail_out = n;
+	while (z.avail_out)
+	{
+		if (!z.avail_in)
+		{
+			std::string_view bytes;
+			if (!input.next(bytes))
+			{
+				if (member) throw std::runtime_error("gzip: unexpected end of input");
+				break;
+			}
+			z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(bytes.data()));
+			z.avail_in = bytes.size();
+		}
+
+		const int r = inflate(&z, Z_NO_FLUSH);
+		if (r == Z_STREAM_END)
+		{
+			inflateReset(&z);
+			member = false;
+		}
+		else if (r == Z_OK || r == Z_BUF_ERROR) member = true;
+		else throw std::runtime_error(std::string("gzip: ") + (z.msg ? z.msg : "invalid data"));
+	}
+	return n - z.avail_out;
+}
+#endif /* ifdef SPLIT_GZIP */
+
+#ifdef SPLIT_ZSTD
+/**
+ * \brief Zstandard decoder
+ *
+ * A mapped file of several frames whose sizes are recorded (e.g. compressed
+ * with pzstd, or concatenated .zst files) is decoded in parallel: as many
+ * frames as fit the read buffer are decompressed at once by a thread each,
+ * every frame straight to its place. Other frames (e.g. a single frame) and
+ * streamed input are decoded one by one.
+ */
+class zstd_decoder : public decoder
+{
+public:
+	explicit zstd_decoder(compressed_input&& input);
+	~zstd_decoder();
+
+	std::size_t read(char* out, std::size_t n);
+	std::size_t block() const { return room; }
+
+private:
+	// Largest frame decoded in parallel, and largest read buffer
+	static constexpr unsigned long long max_frame = 1 << 26, max_room = 1 << 28;
+
+	static void check(std::size_t r)
+	{ if (ZSTD_isError(r)) throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(r)); }
+
+	// Whether a frame is decoded in parallel
+	bool parallel(std::size_t frame) const
+	{
+		const unsigned long long size = frames[frame].content;
+		return size <= max_frame && size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR;
+	}
+
+	// Decode the next frames of a mapped file, or part of a streamed frame
+	std::size_t frames_read(char* out, std::size_t n);
+
+	// Decode the stream (or the current frame of a mapped file)
+	std::size_t stream_read(char* out, std::size_t n);
+
+	compressed_input input;
+	ZSTD_DStream* stream;
+	ZSTD_inBuffer in{};
+	std::size_t last = 0;
+
+	// Frames of a mapped file, the next one and whether it is being streamed
+	struct frame
+	{
+		const char* data;
+		std::size_t size;
+		unsigned long long content;
+	};
+
+	std::vector<frame> frames;
+	std::size_t next = 0;
+	bool streaming = false;
+
+	// One decompression context per thread
+	std::vector<ZSTD_DCtx*> contexts;
+	std::size_t room = 1 << 20;
+};
+
+inline zstd_decoder::zstd_decoder(compressed_input&& _input) :
+	input(std::move(_input)), stream(ZSTD_createDStream())
+{
+	if (!stream) throw std::bad_alloc();
+	if (!input.mapped()) return;
+
+	std::string_view bytes;
+	input.next(bytes);
+	for (std::size_t at = 0; at < bytes.size();)
+	{
+		const std::size_t size = ZSTD_findFrameCompressedSize(bytes.data() + at, bytes.size() - at);
+		check(size);
+		frames.push_back({ bytes.data() + at, size, ZSTD_getFrameContentSize(bytes.data() + at, size) });
+		at += size;
+	}
+
+	// Room for a frame per thread
+	unsigned long long largest = 0;
+	for (std::size_t i = 0; i < frames.size(); i++)
+		if (parallel(i)) largest = std::max(largest, frames[i].content);
+	contexts.resize(std::max(1u, std::thread::hardware_concurrency()));
+	room = std::max<std::size_t>({ room, largest, std::min(largest * contexts.size(), max_room) });
+	for (auto& c: contexts)
+		if (!(c = ZSTD_createDCtx())) throw std::bad_alloc();
+}
+
+inline zstd_decoder::~zstd_decoder()
+{
+	for (auto c: contexts) ZSTD_freeDCtx(c);
+	ZSTD_freeDStream(stream);
+}
+
+inline std::size_t zstd_decoder::stream_read(char* out, std::size_t n)
+{
+	ZSTD_outBuffer o = { out, n, 0 };
+	while (o.pos < o.size)
+	{
+		if (in.pos == in.size)
+		{
+			std::string_view bytes;
+			if (streaming || !input.next(bytes))
+			{
+				if (last) throw std::runtime_error("zstd: unexpected end of input");
+				break;
+			}
+			in = { bytes.data(), bytes.size(), 0 };
+		}
+
+		check(last = ZSTD_decompressStream(stream, &o, &in));
+
+		// End of a streamed frame of a mapped file
+		if (streaming && !last && in.pos == in.size)
+		{
+			streaming = false;
+			next++;
+			break;
+		}
+	}
+	return o.pos;
+}
+
+inline std::size_t zstd_decoder::read(char* out, std::size_t n)
+{
+	if (frames.empty()) return stream_read(out, n);
+
+	// Empty frames decode to nothing, which isn't the end unless they're last
+	std::size_t done;
+	do done = frames_read(out, n);
+	while (!done && (streaming || next < frames.size()));
+	return done;
+}
+
+inline std::size_t zstd_decoder::frames_read(char* out, std::size_t n)
+{
+	if (streaming) return stream_read(out, n);
+
+	// As many whole frames as fit
+	const std::size_t first = next;
+	std::vector<std::size_t> offsets{0};
+	while (next < frames.size() && parallel(next) && offsets.back() + frames[next].content <= n)
+		offsets.push_back(offsets.back() + frames[next++].content);
+
+	if (next == first)
+	{
+		if (next == frames.size()) return 0;
+
+		// Stream a frame of unknown or large size
+		check(ZSTD_DCtx_reset(stream, ZSTD_reset_session_only));
+		in = { frames[next].data, frames[next].size, 0 };
+		streaming = true;
+		return stream_read(out, n);
+	}
+
+	// Decode the frames in parallel, each into its place
+	std::atomic<std::size_t> pick{first};
+	std::vector<std::size_t> results(next - first);
+	const auto work = [&](ZSTD_DCtx* context)
+	{
+		for (std::size_t i; (i = pick++) < next;)
+			results[i - first] = ZSTD_decompressDCtx(context, out + offsets[i - first],
+				frames[i].content, frames[i].data, frames[i].size);
+	};
+
+	std::vector<std::thread> workers;
+	for (std::size_t t = 1; t < contexts.size() && t < next - first; t++) workers.emplace_back(work, contexts[t]);
+	work(contexts[0]);
+	for (auto& w: workers) w.join();
+
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		check(results[i]);
+		if (results[i] != frames[first + i].content) throw std::runtime_error("zstd: frame size mismatch");
+	}
+	return offsets.back();
+}
+#endif /* ifdef SPLIT_ZSTD */
+
+inline std::unique_ptr<decoder> decoder::open(compressed_input&& input, std::string_view head)
+{
+	static_cast<void>(input);	// Unused without any decoder
+	if (head.substr(0, gzip_magic.size()) == gzip_magic)
+	{
+#ifdef SPLIT_GZIP
+		return std::make_unique<gzip_decoder>(std::move(input));
+#else
+		throw std::runtime_error("gzip input is not available (build with -DSPLIT_GZIP -lz).");
+#endif
+	}
+
+	if (head.substr(0, zstd_magic.size()) == zstd_magic)
+	{
+#ifdef SPLIT_ZSTD
+		return std::make_unique<zstd_decoder>(std::move(input));
+#else
+		throw std::runtime_error("zstd input is not available (build with -DSPLIT_ZSTD -lzstd).");
+#endif
+	}
+	return nullptr;
+}
+
+
+#endif /* if __DECODE_H__ */
@@ -0,0 +1,164 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  genmovies.py
+#
+#  Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+
+"""
+===========================================
+Synthetic movies.txt generator
+===========================================
+
+	genmovies.py --lines 100000 --seed 1 > movies.txt
+
+Writes movie lines in the movies.txt format (see split.cpp): 15 fields
+separated with TRIANGLE_BULLET, the genres, directors and cast being lists of
+records separated with DOUBLE_VLINE, whose values are separated with
+DOT_LEADER.
+
+The output only depends on the seed and the settings, hence a corpus can be
+rebuilt anywhere for comparable benchmarks (see bench.py). The settings tune:
+
+ * the cast size, exponentially distributed around a mean, and capped
+ * the title length in words, exponentially distributed around a mean
+ * the number of genres, uniform up to a maximum, a share of which are unknown
+ * the quote density, i.e. the probability of a single quote in a name
+ * the share of empty optional fields
+ * the people pool size, people ids being log-uniform (i.e. some people play
+   in many movies)
+"""
+
+import sys
+import random
+import argparse
+
+# Separators
+DOUBLE_VLINE = '‖'
+TRIANGLE_BULLET = '‣'
+DOT_LEADER = '․'
+
+# Members of the MySQL SET column (see mysql/CreateCB.sql), then unknown ones
+GENRES = ['Thriller', 'Family', 'TV Movie', 'Western', 'Science Fiction',
+	'Drama', 'Action', 'Crime', 'Romance', 'Animation', 'Documentary',
+	'History', 'War', 'Fantasy', 'Music', 'Comedy', 'Horror',
+	'Mystery', 'Adventure']
+UNKNOWN_GENRES = ['Foreign']
+
+STATUS = ['Released', 'Planned', 'In Production', 'Post Production', 'Canceled', 'Rumored']
+CERTIFICATIONS = ['G', 'PG', 'PG-13', 'R', 'NC-17']
+SYLLABLES = ['ka', 'lo', 'mi', 'ran', 'de', 'vi', 'to', 'sel', 'ma', 'ri',
+	'no', 'bel', 'ta', 'zu', 'che', 'fon', 'é', 'ga', 'sto', 'lin']
+
+def arguments(argv=None):
+	""" Parse the command line """
+	parser = argparse.ArgumentParser(description='Generate movies.txt-shaped data.')
+	parser.add_argument('--lines', type=int, default=10000, help='number of movies')
+	parser.add_argument('--seed', type=int, default=1, help='random generator seed')
+	parser.add_argument('--cast-mean', type=float, default=12, help='mean cast size')
+	parser.add_argument('--cast-max', type=int, default=200, help='maximum cast size')
+	parser.add_argument('--title-words', type=float, default=3, help='mean title length, in words')
+	parser.add_argument('--genres-max', type=int, default=3, help='maximum number of genres')
+	parser.add_argument('--unknown-genres', type=float, default=0.01,
+		help='probability of an unknown genre')
+	parser.add_argument('--quotes', type=float, default=0.05,
+		help='probability of a single quote in a name or title')
+	parser.add_argument('--empty', type=float, default=0.1,
+		help='probability of an empty optional field')
+	parser.add_argument('--people', type=int, default=100000, help='people pool size')
+	return parser.parse_args(argv)
+
+
+class Generator(object):
+	def __init__(self, settings):
+		self.settings = settings
+		self.random = random.Random(settings.seed)
+
+	def word(self):
+		r = self.random
+		word = ''.join(r.choice(SYLLABLES) for i in range(r.randint(1, 3))).capitalize()
+		if r.random() < self.settings.quotes:
+			word = word[:1] + "'" + word[1:]
+		return word
+
+	def words(self, mean):
+		count = 1 + int(self.random.expovariate(1 / mean)) if mean > 0 else 1
+		return ' '.join(self.word() for i in range(count))
+
+	def optional(self, value):
+		return '' if self.random.random() < self.settings.empty else value
+
+	def person(self):
+		""" Log-uniform id within the pool: low ids come back often """
+		return str(int(self.settings.people ** self.random.random()))
+
+	def genres(self):
+		r, s = self.random, self.settings
+		names = r.sample(GENRES, r.randint(0, min(s.genres_max, len(GENRES))))
+		if r.random() < s.unknown_genres:
+			names.append(r.choice(UNKNOWN_GENRES))
+		return DOUBLE_VLINE.join(
+			DOT_LEADER.join((str(GENRES.index(g) + 1 if g in GENRES else 99), g)) for g in names)
+
+	def directors(self):
+		return DOUBLE_VLINE.join(
+			DOT_LEADER.join((self.person(), self.words(2))) for i in range(self.random.randint(0, 2)))
+
+	def cast(self):
+		s = self.settings
+		size = min(int(self.random.expovariate(1 / s.cast_mean)), s.cast_max) if s.cast_mean > 0 else 0
+		return DOUBLE_VLINE.join(
+			DOT_LEADER.join((self.person(), self.words(2), self.optional(self.words(1.5))))
+			for i in range(size))
+
+	def movie(self, id):
+		r = self.random
+		title = self.words(self.settings.title_words)
+		return TRIANGLE_BULLET.join((
+			str(id),
+			title,
+			self.optional(title if r.random() < 0.5 else self.words(self.settings.title_words)),
+			self.optional('%04d-%02d-%02d' % (r.randint(1920, 2019), r.randint(1, 12), r.randint(1, 28))),
+			self.optional(r.choice(STATUS)),
+			self.optional('%.1f' % (r.randint(0, 100) / 10)),
+			self.optional(str(r.randint(0, 20000))),
+			self.optional(str(r.randint(60, 240))),
+			self.optional(r.choice(CERTIFICATIONS)),
+			self.optional('/%s.jpg' % ''.join(r.choice('abcdefghijklmnopqrstuvwxyz0123456789') for i in range(27))),
+			self.optional(str(r.randint(0, 300000000))),
+			self.optional(self.words(6)),
+			self.genres(),
+			self.directors(),
+			self.cast(),
+		))
+
+	def lines(self):
+		for id in range(1, self.settings.lines + 1):
+			yield self.movie(id)
+
+
+def generate(settings, output):
+	""" Write a corpus to a text file """
+	for line in Generator(settings).lines():
+		output.write(line)
+		output.write('\n')
+
+
+if __name__ == '__main__':
+	sys.stdout.reconfigure(encoding='utf-8')
+	generate(arguments(), sys.stdout)
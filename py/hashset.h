@@ -0,0 +1,110 @@
+/*
+ * hashset.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __HASHSET_H__
+#define __HASHSET_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * \brief Set of 64-bit integer keys
+ *
+ * Open-addressing hash set with linear probing over a flat, power-of-two sized
+ * array of keys: a lookup usually touches a single cache line, and the memory
+ * footprint is 8 to 16 bytes per key, i.e. some hundred MiB for tens of
+ * millions of keys.
+ *
+ * The slot value 0 marks an empty slot, hence keys are stored incremented by
+ * one and the key ~0 is not supported.
+ */
+class hashset
+{
+public:
+	typedef std::uint64_t key_type;
+
+	// Build a set able to hold the given number of keys before growing
+	explicit hashset(std::size_t capacity = 1 << 16);
+
+	// Add a key, return false if it already exists
+	bool insert(key_type);
+
+	// Number of keys in the set
+	std::size_t size() const { return count; }
+
+private:
+	// Finalizer of the SplitMix64 generator, spreads keys over all bits
+	static key_type mix(key_type k)
+	{
+		k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		k = (k ^ (k >> 27)) * 0x94d049bb133111ebULL;
+		return k ^ (k >> 31);
+	}
+
+	void grow();
+
+	std::vector<key_type> slots;
+	std::size_t mask;
+	std::size_t count = 0;
+};
+
+inline hashset::hashset(std::size_t capacity)
+{
+	// Keep the load factor under 1/2
+	std::size_t size = 16;
+	while (size < 2 * capacity) size <<= 1;
+	slots.assign(size, 0);
+	mask = size - 1;
+}
+
+inline bool hashset::insert(key_type key)
+{
+	const key_type stored = key + 1;
+	for (std::size_t i = mix(key) & mask;; i = (i + 1) & mask)
+	{
+		if (slots[i] == stored) return false;
+		if (slots[i] == 0)
+		{
+			slots[i] = stored;
+			if (++count > slots.size() / 2) grow();
+			return true;
+		}
+	}
+}
+
+inline void hashset::grow()
+{
+	std::vector<key_type> old(2 * slots.size(), 0);
+	old.swap(slots);
+	mask = slots.size() - 1;
+
+	for (const key_type stored: old)
+	{
+		if (stored == 0) continue;
+		std::size_t i = mix(stored - 1) & mask;
+		while (slots[i]) i = (i + 1) & mask;
+		slots[i] = stored;
+	}
+}
+
+
+#endif /* if __HASHSET_H__ */
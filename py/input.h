@@ -0,0 +1,240 @@
+/*
+ * input.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __INPUT_H__
+#define __INPUT_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "decode.h"
+
+/**
+ * \brief Line reader
+ *
+ * Returns every line of the input as a string view, without the line feed.
+ *
+ * A regular file is memory-mapped and lines point straight into the mapping,
+ * hence are never copied. Other files (pipes, terminals) are read with large
+ * read(2) calls into a buffer that lines point into: such views are valid
+ * until the next call to next().
+ *
+ * Compressed input (gzip, zstd) is recognized by its first bytes and decoded
+ * into the read buffer in place of read(2), see decoder.
+ */
+class line_reader
+{
+public:
+	// Read a given file, or the standard input if the path is null
+	explicit line_reader(const char* path = nullptr);
+
+	// Read lines from memory, e.g. a chunk
+	explicit line_reader(std::string_view text) :
+		fd(-1), data(text.data()), size(text.size()), eof(true) {}
+
+	~line_reader();
+
+	line_reader(const line_reader&) = delete;
+	line_reader& operator = (const line_reader&) = delete;
+
+	// Fetch the next line, return false at the end of the input
+	bool next(std::string_view& line);
+
+	// Fetch the next chunk of whole lines: a chunk ends with the first line
+	// feed found after a given size, independently of the input type. Mapped
+	// chunks point into the mapping, others are copied into a given storage.
+	bool next_chunk(std::size_t chunk_size, std::string& storage, std::string_view& chunk);
+
+	// Whether lines point into a memory-mapped file
+	bool mapped() const { return map && !source; }
+
+private:
+	// Size of a read(2) call for streamed input
+	static constexpr std::size_t block_size = 1 << 20;
+
+	int fd = STDIN_FILENO;
+
+	// Memory-mapped input
+	void* map = nullptr;
+	std::size_t map_size = 0;
+
+	// Input data and position of the next line
+	const char* data = nullptr;
+	std::size_t size = 0, offset = 0;
+
+	// Streamed input buffer and end of input flag
+	std::vector<char> buffer;
+	bool eof = false;
+
+	// Decoder of compressed input, once the first bytes are read
+	std::unique_ptr<decoder> source;
+	bool probed = false;
+
+	// Read more streamed data, keeping the pending partial line
+	bool fill();
+};
+
+inline line_reader::line_reader(const char* path)
+{
+	if (path && (fd = ::open(path, O_RDONLY)) < 0)
+		throw std::system_error(errno, std::generic_category(), path);
+
+	// Map regular files, with sequential read-ahead (and huge pages where
+	// supported by the file system)
+	struct stat st;
+	if (path && ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		map_size = st.st_size;
+		map = ::mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) map = nullptr;
+		else
+		{
+			::madvise(map, map_size, MADV_SEQUENTIAL);
+			::madvise(map, map_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+			::madvise(map, map_size, MADV_HUGEPAGE);
+#endif
+			const std::string_view file(static_cast<const char*>(map), map_size);
+			try { source = decoder::open(compressed_input(file), file); }
+			catch (...)
+			{
+				::munmap(map, map_size);
+				::close(fd);
+				throw;
+			}
+			if (!source)
+			{
+				data = file.data();
+				size = map_size;
+				eof = true;
+			}
+		}
+	}
+	probed = map != nullptr;
+}
+
+inline line_reader::~line_reader()
+{
+	if (map) ::munmap(map, map_size);
+	if (fd >= 0 && fd != STDIN_FILENO) ::close(fd);
+}
+
+inline bool line_reader::next(std::string_view& line)
+{
+	for (;;)
+	{
+		const void* stop = offset < size ? std::memchr(data + offset, '\n', size - offset) : nullptr;
+		if (stop)
+		{
+			const std::size_t end = static_cast<const char*>(stop) - data;
+			line = { data + offset, end - offset };
+			offset = end + 1;
+			return true;
+		}
+
+		// Incomplete line: read more, or return the last unterminated line
+		if (!fill())
+		{
+			if (offset == size) return false;
+			line = { data + offset, size - offset };
+			offset = size;
+			return true;
+		}
+	}
+}
+
+inline bool line_reader::next_chunk(std::size_t chunk_size, std::string& storage,
+									std::string_view& chunk)
+{
+	const void* stop = nullptr;
+	while (!(size - offset > chunk_size
+		&& (stop = std::memchr(data + offset + chunk_size, '\n', size - offset - chunk_size))))
+		if (!fill()) break;
+
+	// Whole lines up to the line feed, or the remaining data
+	const std::size_t end = stop ? static_cast<const char*>(stop) - data + 1 : size;
+	if (end == offset) return false;
+
+	chunk = { data + offset, end - offset };
+	offset = end;
+
+	if (!mapped()) chunk = storage.assign(chunk.data(), chunk.size());
+	return true;
+}
+
+inline bool line_reader::fill()
+{
+	if (eof) return false;
+
+	// Move the partial line to the front, then grow to at least one block
+	const std::size_t pending = size - offset;
+	const std::size_t block = source ? source->block() : block_size;
+	if (pending) std::memmove(buffer.data(), data + offset, pending);
+	if (buffer.size() < pending + block) buffer.resize(pending + block);
+
+	const auto get = [&](std::size_t at)
+	{
+		ssize_t r;
+		do r = ::read(fd, buffer.data() + at, buffer.size() - at);
+		while (r < 0 && errno == EINTR);
+		if (r < 0) throw std::system_error(errno, std::generic_category(), "read");
+		return r;
+	};
+
+	ssize_t n;
+	if (source) n = source->read(buffer.data() + pending, buffer.size() - pending);
+	else
+	{
+		n = get(pending);
+
+		// Decode the input from now on if compressed, once the whole magic
+		// number is read (a pipe may deliver fewer bytes at first), but only
+		// wait for more if it may be one: interactive input (e.g. queries to
+		// the search engine) may well be a short line
+		if (!probed)
+		{
+			probed = true;
+			for (ssize_t r = n; r > 0 && decoder::partial({ buffer.data(), std::size_t(n) }); n += r) r = get(n);
+			const std::string_view head(buffer.data(), n);
+			if ((source = decoder::open(compressed_input(fd, head), head)))
+				n = source->read(buffer.data(), buffer.size());
+		}
+	}
+	eof = n == 0;
+
+	data = buffer.data();
+	size = pending + n;
+	offset = 0;
+	return !eof;
+}
+
+
+#endif /* if __INPUT_H__ */
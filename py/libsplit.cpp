@@ -0,0 +1,254 @@
+/**
+ * libsplit.cpp
+ *
+ * DESCRIPTION
+ *
+ * Shared library of the split.cpp parser and SQL formatters behind the C
+ * interface of libsplit.h. split.cpp is included as a whole without its
+ * entry point, and only the interface functions are exported (split_*, see
+ * libsplit.map):
+ *
+ *	g++ -std=c++17 -O2 -pthread -fPIC -shared -fvisibility=hidden \
+ *		-Wl,--version-script=libsplit.map -o libsplit.so libsplit.cpp
+ *
+ * LICENSING
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#define SPLIT_NO_MAIN
+#include "split.cpp"
+
+#include "libsplit.h"
+
+static_assert(SPLIT_MOVIE_FIELDS == schema::size<schema::movies>);
+
+/**
+ * \brief Line parser state
+ *
+ * The structural index and the person arrays are reused from one line to
+ * another, as in the importer.
+ */
+struct split_parser
+{
+	structure index;
+	record movie{raw_movie_fields};
+	std::vector<split_string> genres, directors, cast;
+	std::string error;
+
+	void parse(std::string_view line, split_movie& m);
+};
+
+void split_parser::parse(std::string_view line, split_movie& m)
+{
+	const auto string = [](std::string_view s) { return split_string{ s.data(), s.size() }; };
+
+	index.build(line);
+	movie.parse(index, line, structure::movie_level);
+	for (std::size_t i = 0; i < SPLIT_MOVIE_FIELDS - 1; i++) m.fields[i] = string(movie[i].value);
+	m.fields[SPLIT_MOVIE_FIELDS - 1] = {};
+
+	genres.clear();
+	m.genre_set = 0;
+	record genre(raw_genre_fields);
+	for (indexed_splitter it(index, movie[-3], structure::record_level); it.begin < it.record.size();)
+	{
+		genre.parse(index, *it++, structure::value_level);
+		genres.push_back(string(genre[1].value));
+		const int member = genre_set::find(genre[1].value);
+		if (member >= 0) m.genre_set |= 1u << member;
+	}
+
+	directors.clear();
+	record director(raw_director_fields);
+	for (indexed_splitter it(index, movie[-2], structure::record_level); it.begin < it.record.size();)
+	{
+		director.parse(index, *it++, structure::value_level);
+		for (std::size_t i = 0; i < director.size(); i++) directors.push_back(string(director[i].value));
+	}
+
+	cast.clear();
+	record actor(raw_actor_fields);
+	for (indexed_splitter it(index, movie[-1], structure::record_level); it.begin < it.record.size();)
+	{
+		actor.parse(index, *it++, structure::value_level);
+		for (std::size_t i = 0; i < actor.size(); i++) cast.push_back(string(actor[i].value));
+	}
+
+	m.genres = genres.data();
+	m.genre_count = genres.size();
+	m.directors = directors.data();
+	m.director_count = directors.size() / 2;
+	m.cast = cast.data();
+	m.cast_count = cast.size() / 3;
+}
+
+/**
+ * \brief SQL formatter state
+ *
+ * Unbatched formatters of both dialects write to a memory buffer, cleared
+ * before every statement.
+ */
+struct split_formatter
+{
+	const split_dialect dialect;
+	writer out{-1, 1 << 12};
+	MySQL mysql{out};
+	PostgreSQL postgres{out};
+	std::pmr::string genre;
+	std::string error;
+
+	explicit split_formatter(split_dialect d) : dialect(d) {}
+
+	template <typename Table>
+	void insert(const split_string* values, std::size_t count);
+};
+
+template <typename Table>
+void split_formatter::insert(const split_string* values, std::size_t count)
+{
+	schema::row<Table> row;
+	if (count != row.size())
+		throw std::invalid_argument(std::string(Table::name) + ": expected "
+			+ std::to_string(row.size()) + " values, got " + std::to_string(count));
+	for (std::size_t i = 0; i < row.size(); i++) row[i] = { values[i].data, values[i].size };
+
+	// The MySQL genre set is written unquoted (see MySQL::insert): it must be
+	// a number, as split_format_genres() renders it
+	constexpr int genre = schema::column<Table>(genre_column);
+	if constexpr (genre >= 0)
+		if (dialect == SPLIT_MYSQL && row[genre].find_first_not_of("0123456789") != row[genre].npos)
+			throw std::invalid_argument(std::string(Table::name) + '.' + genre_column
+				+ ": a MySQL SET value must be a number");
+
+	out.clear();
+	if (dialect == SPLIT_MYSQL) mysql.insert<Table>(row);
+	else postgres.insert<Table>(row);
+}
+
+// Call a function with the schema type of a table, or return false
+template <typename Function>
+static bool with_table(split_table table, Function&& f)
+{
+	switch (table)
+	{
+	case SPLIT_MOVIES: f(schema::movies()); return true;
+	case SPLIT_PEOPLE: f(schema::people()); return true;
+	case SPLIT_DIRECTORS: f(schema::directors()); return true;
+	case SPLIT_CHARACTERS: f(schema::characters()); return true;
+	}
+	return false;
+}
+
+extern "C" {
+
+uint32_t split_version(void) { return SPLIT_VERSION; }
+
+const char* split_table_name(split_table table)
+{
+	const char* name = nullptr;
+	with_table(table, [&](auto t) { name = decltype(t)::name; });
+	return name;
+}
+
+size_t split_columns(split_table table, const char* const** names)
+{
+	size_t count = 0;
+	with_table(table, [&](auto t)
+	{
+		using Table = decltype(t);
+		if (names) *names = Table::columns;
+		count = schema::size<Table>;
+	});
+	return count;
+}
+
+const char* split_genre(unsigned i)
+{ return i < std::size(genre_set::names) ? genre_set::names[i].data() : nullptr; }
+
+split_parser* split_parser_new(void)
+{
+	try { return new split_parser; }
+	catch (...) { return nullptr; }
+}
+
+void split_parser_free(split_parser* p) { delete p; }
+
+int split_parse(split_parser* p, const char* line, size_t size, split_movie* movie)
+{
+	try
+	{
+		p->parse({ line, size }, *movie);
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		p->error = e.what();
+		return -1;
+	}
+}
+
+const char* split_parser_error(const split_parser* p) { return p->error.c_str(); }
+
+split_formatter* split_formatter_new(split_dialect dialect)
+{
+	if (dialect != SPLIT_MYSQL && dialect != SPLIT_POSTGRES) return nullptr;
+	try { return new split_formatter(dialect); }
+	catch (...) { return nullptr; }
+}
+
+void split_formatter_free(split_formatter* f) { delete f; }
+
+int split_format_genres(split_formatter* f, uint32_t set, split_string* value)
+{
+	try
+	{
+		f->genre.clear();
+		if (f->dialect == SPLIT_MYSQL) f->mysql.list(set, f->genre);
+		else f->postgres.list(set, f->genre);
+		*value = { f->genre.data(), f->genre.size() };
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		f->error = e.what();
+		return -1;
+	}
+}
+
+int split_format_insert(split_formatter* f, split_table table,
+						const split_string* values, size_t count, split_string* statement)
+{
+	try
+	{
+		if (!with_table(table, [&](auto t) { f->insert<decltype(t)>(values, count); }))
+			throw std::invalid_argument("unknown table " + std::to_string(table));
+		const std::string_view s = f->out.view();
+		*statement = { s.data(), s.size() };
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		f->error = e.what();
+		return -1;
+	}
+}
+
+const char* split_formatter_error(const split_formatter* f) { return f->error.c_str(); }
+
+}
@@ -0,0 +1,143 @@
+/**
+ * libsplit.h
+ *
+ * DESCRIPTION
+ *
+ * C interface of the split.cpp parser and SQL formatters, built as a shared
+ * library (see libsplit.cpp) for other languages, e.g. the _split Python
+ * extension (see splitmodule.c) which split.py and db.py use when available.
+ *
+ * Only plain C types cross the interface, and structures are only ever
+ * extended at their end: a program built against a given version runs with
+ * any later library of the same major version (see split_version()).
+ *
+ * Parsed strings are not copied: they point into the parsed line, or into
+ * the parser, and are valid until the next line is parsed. No function
+ * throws: failures return an error code, and a message (see split_error()).
+ *
+ * LICENSING
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __LIBSPLIT_H__
+#define __LIBSPLIT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef SPLIT_API
+#define SPLIT_API __attribute__((visibility("default")))
+#endif
+
+// Interface version: major << 16 | minor
+#define SPLIT_VERSION ((1 << 16) | 0)
+
+// Byte string, not null-terminated
+typedef struct
+{
+	const char* data;
+	size_t size;
+} split_string;
+
+// Number of movie columns, i.e. "id" to "tag_line" then "genre"
+#define SPLIT_MOVIE_FIELDS 13
+
+/**
+ * \brief Parsed movie line
+ *
+ * The movie columns in table order (see split_columns()), the genre column
+ * being empty, then the genre names, and the directors (id, name) and the
+ * cast (id, name, character) as flat arrays of 2 and 3 strings per person.
+ */
+typedef struct
+{
+	split_string fields[SPLIT_MOVIE_FIELDS];
+
+	// Genre names, and the set of the known ones (bit i: split_genre(i))
+	const split_string* genres;
+	size_t genre_count;
+	uint32_t genre_set;
+
+	const split_string* directors;
+	size_t director_count;
+
+	const split_string* cast;
+	size_t cast_count;
+} split_movie;
+
+// Target tables
+typedef enum { SPLIT_MOVIES, SPLIT_PEOPLE, SPLIT_DIRECTORS, SPLIT_CHARACTERS } split_table;
+
+// SQL dialects
+typedef enum { SPLIT_MYSQL, SPLIT_POSTGRES } split_dialect;
+
+typedef struct split_parser split_parser;
+typedef struct split_formatter split_formatter;
+
+// Version of the library (see SPLIT_VERSION)
+SPLIT_API uint32_t split_version(void);
+
+// Name of a table, its number of columns and their names (static strings),
+// or null/0 if there's no such table
+SPLIT_API const char* split_table_name(split_table table);
+SPLIT_API size_t split_columns(split_table table, const char* const** names);
+
+// Name of genre i (a static string), or null
+SPLIT_API const char* split_genre(unsigned i);
+
+/**
+ * \brief Line parser
+ *
+ * Parse a movie line (without its line feed) into a movie: return 0, or -1
+ * if the line can't be parsed (e.g. too long).
+ */
+SPLIT_API split_parser* split_parser_new(void);
+SPLIT_API void split_parser_free(split_parser*);
+SPLIT_API int split_parse(split_parser*, const char* line, size_t size, split_movie* movie);
+SPLIT_API const char* split_parser_error(const split_parser*);
+
+/**
+ * \brief SQL formatter
+ *
+ * Format the INSERT statement of a row in the dialect of split.cpp, e.g.
+ * "INSERT IGNORE people(id, full_name) VALUES ('1', 'Name');\n": values are
+ * given in column order, empty ones being skipped, and the movie genre is
+ * either a MySQL SET value (a number, anything else being rejected) or a
+ * PostgreSQL array. Return 0 and set the statement, valid until the next
+ * call, or -1.
+ *
+ * The genre value of a set is written to a buffer of the formatter, hence is
+ * valid until the next call too.
+ */
+SPLIT_API split_formatter* split_formatter_new(split_dialect dialect);
+SPLIT_API void split_formatter_free(split_formatter*);
+SPLIT_API int split_format_genres(split_formatter*, uint32_t set, split_string* value);
+SPLIT_API int split_format_insert(split_formatter*, split_table table,
+								  const split_string* values, size_t count, split_string* statement);
+SPLIT_API const char* split_formatter_error(const split_formatter*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* if __LIBSPLIT_H__ */
@@ -0,0 +1,353 @@
+/*
+ * output.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <system_error>
+#include <chrono>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "scan.h"
+
+/**
+ * \brief Buffered output
+ *
+ * An append-only byte buffer which is written out to a file descriptor with
+ * write(2) whenever full, or kept in memory as a whole if there's no file
+ * descriptor (e.g. a chunk output in a parallel import). It replaces output
+ * streams on the formatting path: no locale, no sentry, no virtual call per
+ * character.
+ *
+ * SQL values are quoted by quoted(), which copies whole vectors of characters
+ * at once and doubles the quotes found (see scan::escape).
+ *
+ * Output to a pipe (e.g. "split --mysql | mysql") may instead hand the buffer
+ * pages to the pipe with vmsplice(2), saving the copy made by write(2), see
+ * splice(). The pages are then read by the consumer in place, hence a buffer
+ * must not be reused until read: the writer alternates between two page-
+ * aligned buffers, so that formatting into one overlaps with the consumer
+ * draining the other, and only waits if the consumer lags a whole buffer
+ * behind.
+ */
+class writer
+{
+public:
+	// Write to a file descriptor, or keep everything in memory if negative
+	explicit writer(int _fd = -1, std::size_t _capacity = 1 << 20) :
+		fd(_fd), capacity(_capacity), data(new char[capacity]), base(data.get()) {}
+
+	// Open a file for writing
+	explicit writer(const std::string& path, std::size_t _capacity = 1 << 20);
+
+	// Flush and close (if opened) the file, ignoring errors: call close() or
+	// flush() to handle them
+	~writer();
+
+	writer(const writer&) = delete;
+	writer& operator = (const writer&) = delete;
+
+	// Append raw data
+	writer& write(const char* s, std::size_t n);
+
+	writer& operator << (std::string_view s) { return write(s.data(), s.size()); }
+	writer& operator << (const char* s) { return write(s, std::strlen(s)); }
+	writer& operator << (const std::string& s) { return write(s.data(), s.size()); }
+
+	writer& operator << (char c)
+	{
+		if (size == capacity) grow(1);
+		base[size++] = c;
+		return *this;
+	}
+
+	// Append a quoted value, doubling the quote marks within
+	writer& quoted(std::string_view, char quote = '\'');
+
+	// Buffered data (the whole output in memory mode)
+	std::string_view view() const { return { base, size }; }
+	void clear() { size = 0; }
+
+	// Number of bytes written out and buffered
+	std::uint64_t total() const { return written + size; }
+
+	// Time spent in write(2) calls, in nanoseconds, if timed
+	bool timed = false;
+	std::uint64_t write_time = 0;
+
+	// Write out the buffered data (NOOP in memory mode)
+	void flush();
+
+	// Flush and close an opened file
+	void close();
+
+	// Hand the output to the file descriptor with vmsplice(2) if it is a pipe,
+	// and return whether it is. Flushing then waits until the consumer has
+	// read the buffer to be reused, and closing until it has read everything.
+	// Only for consumers which copy what they read: one which splices it
+	// further (e.g. "pv") may still reference the pages once reused.
+	bool splice();
+
+private:
+	// Make room for n more bytes: flush or grow the buffer
+	void grow(std::size_t n);
+
+	// Allocate a buffer of a given size, and return its start aligned to
+	// alignment (pages in pipe mode, for vmsplice(2) to hand them over)
+	char* allocate(std::unique_ptr<char[]>& storage, std::size_t bytes) const;
+
+	// Write data to the file descriptor
+	void put(const char*, std::size_t);
+
+	// Hand the buffer to the pipe, or write it if vmsplice(2) is unsupported
+	void send();
+
+	// Wait until the consumer has read the output up to a given offset
+	void wait(std::uint64_t offset);
+
+	int fd;
+	bool owned = false;
+	std::size_t capacity, size = 0;
+	std::uint64_t written = 0;
+	std::unique_ptr<char[]> data;
+	char* base;
+	std::size_t alignment = 1;
+
+	// Pipe mode: the other buffer, and the output offset of its end
+	bool spliced = false;
+	std::unique_ptr<char[]> spare;
+	char* spare_base = nullptr;
+	std::size_t spare_capacity = 0;
+	std::uint64_t spare_end = 0;
+};
+
+inline writer::writer(const std::string& path, std::size_t _capacity) :
+	writer(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644), _capacity)
+{
+	if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+	owned = true;
+}
+
+inline writer::~writer()
+{
+	try { close(); }
+	catch (...) {}
+}
+
+inline writer& writer::write(const char* s, std::size_t n)
+{
+	// Write large data straight to the file rather than grow the buffer
+	if (fd >= 0 && n >= capacity)
+	{
+		flush();
+		put(s, n);
+		return *this;
+	}
+
+	if (capacity - size < n) grow(n);
+	std::memcpy(base + size, s, n);
+	size += n;
+	return *this;
+}
+
+inline writer& writer::quoted(std::string_view s, char quote)
+{
+	const std::size_t n = 2 * s.size() + 2 + scan::escape_padding;
+	if (capacity - size < n) grow(n);
+
+	base[size++] = quote;
+	size += scan::escape(s.data(), s.size(), base + size, quote);
+	base[size++] = quote;
+	return *this;
+}
+
+inline void writer::flush()
+{
+	if (fd < 0 || size == 0) return;
+	if (!spliced)
+	{
+		put(base, size);
+		size = 0;
+		return;
+	}
+
+	// Swap buffers, then wait until the other one has been read
+	send();
+	size = 0;
+	data.swap(spare);
+	std::swap(base, spare_base);
+	std::swap(capacity, spare_capacity);
+	const std::uint64_t end = spare_end;
+	spare_end = written;
+	wait(end);
+}
+
+inline void writer::put(const char* s, std::size_t size)
+{
+	typedef std::chrono::steady_clock clock;
+	const clock::time_point start = timed ? clock::now() : clock::time_point();
+
+	for (std::size_t done = 0; done < size;)
+	{
+		const ssize_t n = ::write(fd, s + done, size - done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) throw std::system_error(errno, std::generic_category(), "write");
+		done += n;
+	}
+	written += size;
+
+	if (timed)
+		write_time += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+}
+
+inline void writer::send()
+{
+	typedef std::chrono::steady_clock clock;
+	const clock::time_point start = timed ? clock::now() : clock::time_point();
+
+	for (std::size_t done = 0; done < size;)
+	{
+		const iovec v = { base + done, size - done };
+		const ssize_t n = ::vmsplice(fd, &v, 1, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && !done && (errno == EINVAL || errno == ENOSYS))
+		{
+			// Not supported after all: write from now on
+			wait(written);
+			spliced = false;
+			put(base, size);
+			return;
+		}
+		if (n < 0) throw std::system_error(errno, std::generic_category(), "vmsplice");
+		done += n;
+	}
+	written += size;
+
+	if (timed)
+		write_time += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+}
+
+inline void writer::wait(std::uint64_t offset)
+{
+	typedef std::chrono::steady_clock clock;
+	const clock::time_point start = timed ? clock::now() : clock::time_point();
+
+	// Unread bytes tell the consumer's position (or less, should another
+	// process write to the same pipe). A pipe only wakes its writer up when
+	// there's room in it (POLLOUT), not once drained to some point, so the
+	// writer blocks while the pipe is full, then polls with sleeps doubling
+	// up to a millisecond: at most a thousand wakeups per second, and only
+	// while the consumer lags a whole buffer behind.
+	useconds_t pause = 50;
+	for (int unread; spliced; )
+	{
+		if (::ioctl(fd, FIONREAD, &unread) < 0)
+			throw std::system_error(errno, std::generic_category(), "ioctl");
+		if (std::uint64_t(unread) <= written && written - unread >= offset) break;
+
+		pollfd p = { fd, POLLOUT, 0 };
+		if (::poll(&p, 1, 0) == 0) ::poll(&p, 1, -1);
+		else
+		{
+			::usleep(pause);
+			pause = std::min<useconds_t>(2 * pause, 1000);
+		}
+		if (p.revents & POLLERR) break;		// No reader left
+	}
+
+	if (timed)
+		write_time += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+}
+
+inline bool writer::splice()
+{
+	struct stat st;
+	if (fd < 0 || spliced || ::fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode)) return false;
+
+	// Two page-aligned buffers, the pipe holding up to one of them if allowed
+	alignment = ::sysconf(_SC_PAGESIZE);
+	capacity = (capacity + alignment - 1) / alignment * alignment;
+	::fcntl(fd, F_SETPIPE_SZ, capacity);
+
+	std::unique_ptr<char[]> storage;
+	char* const aligned = allocate(storage, capacity);
+	std::memcpy(aligned, base, size);
+	data.swap(storage);
+	base = aligned;
+	spare_base = allocate(spare, capacity);
+	spare_capacity = capacity;
+	spare_end = written;
+	spliced = true;
+	return true;
+}
+
+inline void writer::close()
+{
+	flush();
+	wait(written);
+	if (!owned) return;
+
+	const int closing = fd;
+	owned = false;
+	fd = -1;
+	if (::close(closing) < 0) throw std::system_error(errno, std::generic_category(), "close");
+}
+
+inline void writer::grow(std::size_t n)
+{
+	flush();
+	if (capacity - size >= n) return;
+
+	// Memory mode, or a single write larger than the buffer (e.g. a quoted
+	// value), keeping whole pages in pipe mode
+	std::size_t new_capacity = 2 * capacity;
+	while (new_capacity - size < n) new_capacity *= 2;
+
+	std::unique_ptr<char[]> new_data;
+	char* const new_base = allocate(new_data, new_capacity);
+	std::memcpy(new_base, base, size);
+	data.swap(new_data);
+	base = new_base;
+	capacity = new_capacity;
+}
+
+inline char* writer::allocate(std::unique_ptr<char[]>& storage, std::size_t bytes) const
+{
+	storage.reset(new char[bytes + alignment - 1]);
+	const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(storage.get());
+	return reinterpret_cast<char*>((start + alignment - 1) / alignment * alignment);
+}
+
+
+#endif /* if __OUTPUT_H__ */
@@ -0,0 +1,276 @@
+/*
+ * scan.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/**
+ * \brief Vectorized delimiter search
+ *
+ * Field delimiters are 3-byte UTF-8 sequences which all begin with the lead
+ * bytes 0xE2 0x80. The vector kernels compare 16 (SSE2), 32 (AVX2) or 64
+ * (AVX-512) positions at once against the first and the last byte of the
+ * delimiter, and only confirm the bytes in between on candidate positions
+ * (see http://0x80.pl/articles/simd-strfind.html).
+ *
+ * The same kind of kernel marks the positions of all delimiters in bitmaps,
+ * in a single pass, which makes a structural index of a whole line. Another
+ * one copies SQL values whole vectors at a time, doubling quotes.
+ *
+ * Kernels are picked at run time from the CPU features. Every kernel returns
+ * the same result as its scalar fallback, e.g. std::string_view::find().
+ */
+namespace scan
+{
+	typedef std::size_t (*kernel)(std::string_view, std::string_view, std::size_t);
+
+	typedef void (*marks_kernel)(std::string_view, const char*, const char*, std::uint64_t*);
+	typedef std::size_t (*escape_kernel)(const char*, std::size_t, char*, char);
+
+	// Scalar fallbacks
+	inline std::size_t find_scalar(std::string_view s, std::string_view mark, std::size_t pos)
+	{ return s.find(mark, pos); }
+
+	inline void marks_scalar(std::string_view s, const char* lead, const char* last, std::uint64_t* out)
+	{
+		std::fill(out, out + 3 * (s.size() / 64 + 1), 0);
+		for (std::size_t pos = 0; pos + 2 < s.size(); pos++)
+			if (s[pos] == lead[0] && s[pos + 1] == lead[1])
+				for (std::size_t k = 0; k < 3; k++)
+					if (s[pos + 2] == last[k]) out[3 * (pos / 64) + k] |= std::uint64_t(1) << pos % 64;
+	}
+
+	inline std::size_t escape_scalar(const char* src, std::size_t n, char* dst, char quote)
+	{
+		char* const start = dst;
+		for (const char* end = src + n; src != end; src++)
+		{
+			if (*src == quote) *dst++ = quote;
+			*dst++ = *src;
+		}
+		return dst - start;
+	}
+
+#ifdef SCAN_X86
+	// Confirm candidate positions from a bit mask, return the first match
+	inline bool confirm(const char* p, std::string_view mark, std::uint64_t mask, std::size_t& offset)
+	{
+		while (mask)
+		{
+			const unsigned bit = __builtin_ctzll(mask);
+			if (std::memcmp(p + bit + 1, mark.data() + 1, mark.size() - 2) == 0)
+			{
+				offset = bit;
+				return true;
+			}
+			mask &= mask - 1;
+		}
+		return false;
+	}
+
+	// Vector loop, generated for each instruction set: the last byte is loaded
+	// at mark.size() - 1 from the first, hence the scan stops that many bytes
+	// before the end for the scalar tail to check
+#define SCAN_KERNEL(name, isa, width, vec, set1, load, match)	\
+	__attribute__((target(isa)))										\
+	inline std::size_t name(std::string_view s, std::string_view mark, std::size_t pos) \
+	{																	\
+		if (mark.size() < 2) return s.find(mark, pos);					\
+		const std::size_t last = mark.size() - 1;						\
+		const vec first_byte = set1(mark[0]);						\
+		const vec last_byte = set1(mark[last]);						\
+		for (; pos + last + width <= s.size(); pos += width)			\
+		{																\
+			const char* p = s.data() + pos;								\
+			const vec a = load(p);									\
+			const vec b = load(p + last);							\
+			const std::uint64_t mask = match(a, b, first_byte, last_byte); \
+			std::size_t offset;											\
+			if (mask && confirm(p, mark, mask, offset)) return pos + offset; \
+		}																\
+		return s.find(mark, pos);										\
+	}
+
+#define SCAN_LOAD128(p) _mm_loadu_si128(reinterpret_cast<const __m128i*>(p))
+#define SCAN_MATCH128(a, b, f, l) std::uint64_t(std::uint32_t(_mm_movemask_epi8( \
+	_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)))))
+
+#define SCAN_LOAD256(p) _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define SCAN_MATCH256(a, b, f, l) std::uint64_t(std::uint32_t(_mm256_movemask_epi8( \
+	_mm256_and_si256(_mm256_cmpeq_epi8(a, f), _mm256_cmpeq_epi8(b, l)))))
+
+#define SCAN_LOAD512(p) _mm512_loadu_si512(p)
+#define SCAN_MATCH512(a, b, f, l) std::uint64_t( \
+	_mm512_cmpeq_epi8_mask(a, f) & _mm512_cmpeq_epi8_mask(b, l))
+
+	SCAN_KERNEL(find_sse2, "sse2", 16, __m128i, _mm_set1_epi8, SCAN_LOAD128, SCAN_MATCH128)
+	SCAN_KERNEL(find_avx2, "avx2", 32, __m256i, _mm256_set1_epi8, SCAN_LOAD256, SCAN_MATCH256)
+	SCAN_KERNEL(find_avx512, "avx512f,avx512bw", 64, __m512i, _mm512_set1_epi8, SCAN_LOAD512, SCAN_MATCH512)
+
+	// Vector loop filling the bitmaps of 64 positions at a time, from whole
+	// vectors: the last bytes are copied to a zero-padded block, so that no
+	// sequence is found past the end
+#define SCAN_MARKS(name, isa, width, vec, set1, load, match)		\
+	__attribute__((target(isa)))										\
+	inline void name(std::string_view s, const char* lead, const char* last, std::uint64_t* out) \
+	{																	\
+		const vec lead0 = set1(lead[0]), lead1 = set1(lead[1]);		\
+		const vec last0 = set1(last[0]), last1 = set1(last[1]), last2 = set1(last[2]); \
+		char tail[64 + 2];												\
+		for (std::size_t pos = 0; pos <= s.size(); pos += 64, out += 3)	\
+		{																\
+			const char* p = s.data() + pos;								\
+			if (pos + sizeof tail > s.size())							\
+			{															\
+				std::memset(tail, 0, sizeof tail);						\
+				std::memcpy(tail, p, s.size() - pos);					\
+				p = tail;												\
+			}															\
+			std::uint64_t m0 = 0, m1 = 0, m2 = 0;						\
+			for (unsigned i = 0; i < 64; i += width)					\
+			{															\
+				const vec c = load(p + i + 2);							\
+				const std::uint64_t leads = match(load(p + i), load(p + i + 1), lead0, lead1); \
+				m0 |= (match(c, c, last0, last0) & leads) << i;			\
+				m1 |= (match(c, c, last1, last1) & leads) << i;			\
+				m2 |= (match(c, c, last2, last2) & leads) << i;			\
+			}															\
+			out[0] = m0;												\
+			out[1] = m1;												\
+			out[2] = m2;												\
+		}																\
+	}
+
+	SCAN_MARKS(marks_sse2, "sse2", 16, __m128i, _mm_set1_epi8, SCAN_LOAD128, SCAN_MATCH128)
+	SCAN_MARKS(marks_avx2, "avx2", 32, __m256i, _mm256_set1_epi8, SCAN_LOAD256, SCAN_MATCH256)
+	SCAN_MARKS(marks_avx512, "avx512f,avx512bw", 64, __m512i, _mm512_set1_epi8, SCAN_LOAD512, SCAN_MATCH512)
+
+	// Vector loop copying whole vectors and doubling the first quote found in
+	// each, if any
+#define SCAN_ESCAPE(name, isa, width, vec, set1, load, store, match)		\
+	__attribute__((target(isa)))										\
+	inline std::size_t name(const char* src, std::size_t n, char* dst, char quote) \
+	{																	\
+		const vec quotes = set1(quote);									\
+		char* const start = dst;										\
+		std::size_t i = 0;												\
+		while (i + width <= n)											\
+		{																\
+			const vec v = load(src + i);								\
+			store(dst, v);												\
+			const std::uint64_t mask = match(v, v, quotes, quotes);		\
+			if (!mask) { i += width; dst += width; continue; }			\
+			const unsigned k = __builtin_ctzll(mask) + 1;				\
+			dst += k;													\
+			*dst++ = quote;												\
+			i += k;														\
+		}																\
+		return dst - start + escape_scalar(src + i, n - i, dst, quote); \
+	}
+
+#define SCAN_STORE128(p, v) _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v)
+#define SCAN_STORE256(p, v) _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v)
+#define SCAN_STORE512(p, v) _mm512_storeu_si512(p, v)
+
+	SCAN_ESCAPE(escape_sse2, "sse2", 16, __m128i, _mm_set1_epi8, SCAN_LOAD128, SCAN_STORE128, SCAN_MATCH128)
+	SCAN_ESCAPE(escape_avx2, "avx2", 32, __m256i, _mm256_set1_epi8, SCAN_LOAD256, SCAN_STORE256, SCAN_MATCH256)
+	SCAN_ESCAPE(escape_avx512, "avx512f,avx512bw", 64, __m512i, _mm512_set1_epi8, SCAN_LOAD512, SCAN_STORE512, SCAN_MATCH512)
+
+#undef SCAN_ESCAPE
+#undef SCAN_STORE128
+#undef SCAN_STORE256
+#undef SCAN_STORE512
+
+#undef SCAN_KERNEL
+#undef SCAN_MARKS
+#undef SCAN_LOAD128
+#undef SCAN_MATCH128
+#undef SCAN_LOAD256
+#undef SCAN_MATCH256
+#undef SCAN_LOAD512
+#undef SCAN_MATCH512
+#endif
+
+	// Pick the widest kernel supported by the CPU
+	template <typename T>
+	inline T select(T avx512, T avx2, T sse2, T scalar)
+	{
+#ifdef SCAN_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512bw")) return avx512;
+		if (__builtin_cpu_supports("avx2")) return avx2;
+		if (__builtin_cpu_supports("sse2")) return sse2;
+#endif
+		return scalar;
+	}
+
+	// Find a delimiter from a given position, as std::string_view::find()
+	inline std::size_t find(std::string_view s, std::string_view mark, std::size_t pos = 0)
+	{
+#ifdef SCAN_X86
+		static const kernel k = select<kernel>(find_avx512, find_avx2, find_sse2, find_scalar);
+#else
+		static const kernel k = find_scalar;
+#endif
+		return k(s, mark, pos);
+	}
+
+	// Mark the 3-byte sequences made of two lead bytes and one of three last
+	// (non-NUL) bytes, in a single pass: bit pos % 64 of out[3 * (pos / 64) + k]
+	// is set if the sequence at pos ends with last[k]. Fills s.size() / 64 + 1
+	// groups of 3 words.
+	inline void marks(std::string_view s, const char* lead, const char* last, std::uint64_t* out)
+	{
+#ifdef SCAN_X86
+		static const marks_kernel k = select<marks_kernel>(marks_avx512, marks_avx2, marks_sse2, marks_scalar);
+#else
+		static const marks_kernel k = marks_scalar;
+#endif
+		k(s, lead, last, out);
+	}
+
+	// Copy a string, doubling every quote character found, and return the
+	// output size: the destination must hold 2 * n + escape_padding bytes
+	static constexpr std::size_t escape_padding = 64;
+
+	inline std::size_t escape(const char* src, std::size_t n, char* dst, char quote)
+	{
+#ifdef SCAN_X86
+		static const escape_kernel k = select<escape_kernel>(escape_avx512, escape_avx2, escape_sse2, escape_scalar);
+#else
+		static const escape_kernel k = escape_scalar;
+#endif
+		return k(src, n, dst, quote);
+	}
+}
+
+
+#endif /* if __SCAN_H__ */
@@ -0,0 +1,372 @@
+/**
+ * search.cpp
+ *
+ * DESCRIPTION
+ *
+ * In-memory movie search engine over a columnar snapshot of movies.txt (see
+ * split.cpp --snapshot), answering lookups by movie id, exact title, actor
+ * and director without a database server:
+ *
+ *	g++ -std=c++17 -O2 -o search search.cpp
+ *	./split --snapshot movies.snap < movies.txt
+ *	./search movies.snap title Blade Runner
+ *	./search movies.snap < queries.txt
+ *
+ * A query is a line made of a command and its argument:
+ *
+ * - "id ID": the movie of an id
+ * - "title TITLE": the movies of an exact title
+ * - "actor ID|NAME", "director ID|NAME": the movies of a person, given the
+ *   person id or exact full name
+ * - "person ID|NAME": the people of an id or exact full name
+ * - "title-contains TEXT": the movies whose title or original title contains
+ *   a text, ignoring the case of ASCII and Latin-1 letters (i.e. LIKE
+ *   '%TEXT%', see trigram::fold)
+ * - "name-contains TEXT": the people whose full name contains a text
+ *
+ * Every result is a line of tab-separated values, i.e. "id, title" of movies
+ * or "id, full_name" of people, and the results of a query end with an empty
+ * line. Without a query on the command line, queries are read from stdin one
+ * per line and answered as they come (the output is flushed after every
+ * query), so that a client (e.g. RechFilmCC.py) keeps a single process.
+ *
+ * The snapshot is mapped in place. Loading builds hash indexes of the movie
+ * and person ids and names (and titles), and the reverse adjacency lists of
+ * people to their movies: a lookup is a few cache misses, i.e. microseconds.
+ * Substring queries use the trigram indexes saved in the snapshot (see
+ * trigram.h), or scan the column if there is none or if the text is shorter
+ * than 3 bytes.
+ *
+ * LICENSING
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>			// For EXIT_(SUCCESS|FAILURE)
+#include <iostream>
+#include <cstdint>
+#include <charconv>			// For std::from_chars()
+#include <string_view>
+#include <vector>
+#include <algorithm>		// For remove_if/set_union
+#include <iterator>
+#include "input.h"
+#include "output.h"
+#include "state.h"			// For fingerprint()
+#include "snapshot.h"
+#include "trigram.h"
+
+static_assert(__cplusplus >= 201703L, "compile option -std=c++17 is required.");
+
+/**
+ * \brief Hash index
+ *
+ * Open-addressing multimap of 64-bit keys to row numbers, with linear probing
+ * over a power-of-two table of (key, row) pairs sized once for a load factor
+ * under 1/2: a lookup usually touches a single cache line. Keys may repeat
+ * (e.g. the hash of a common name): a slot holds the last row of its key and
+ * rows are chained to the previous row of the same key, so that probe
+ * sequences stay short. Equal hashes of different strings are told apart by
+ * the caller.
+ */
+class hash_index
+{
+public:
+	// Build an index of the rows [0, count)
+	explicit hash_index(std::size_t count);
+
+	void insert(std::uint64_t key, std::uint32_t row);
+
+	// Call a function with every row of a key
+	template <typename Function>
+	void find(std::uint64_t key, Function&& f) const;
+
+private:
+	static constexpr std::uint32_t empty = ~std::uint32_t(0);
+
+	struct slot
+	{
+		std::uint64_t key;
+		std::uint32_t row;
+	};
+
+	// Finalizer of the SplitMix64 generator (see hashset)
+	static std::uint64_t mix(std::uint64_t k)
+	{
+		k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		k = (k ^ (k >> 27)) * 0x94d049bb133111ebULL;
+		return k ^ (k >> 31);
+	}
+
+	std::vector<slot> slots;
+	std::size_t mask;
+
+	// Previous row of the same key, or empty
+	std::vector<std::uint32_t> chain;
+};
+
+hash_index::hash_index(std::size_t count)
+{
+	std::size_t size = 16;
+	while (size < 2 * count) size <<= 1;
+	slots.assign(size, { 0, empty });
+	mask = size - 1;
+	chain.assign(count, empty);
+}
+
+void hash_index::insert(std::uint64_t key, std::uint32_t row)
+{
+	std::size_t i = mix(key) & mask;
+	while (slots[i].row != empty && slots[i].key != key) i = (i + 1) & mask;
+	chain[row] = slots[i].row;
+	slots[i] = { key, row };
+}
+
+template <typename Function>
+void hash_index::find(std::uint64_t key, Function&& f) const
+{
+	std::size_t i = mix(key) & mask;
+	while (slots[i].row != empty && slots[i].key != key) i = (i + 1) & mask;
+
+	// Rows come in reverse order of insertion
+	for (std::uint32_t row = slots[i].row; row != empty; row = chain[row]) f(row);
+}
+
+/**
+ * \brief Search engine
+ *
+ * Indexes of a mapped snapshot. Movies and people are identified by their row
+ * in the snapshot columns. Strings are indexed by their fingerprint.
+ */
+class engine
+{
+public:
+	explicit engine(const char* path);
+
+	// Answer a query line (see above)
+	void query(std::string_view line, writer& out) const;
+
+private:
+	// Reverse adjacency lists: the movie rows of every person row
+	struct reverse
+	{
+		std::vector<std::uint64_t> offsets;
+		std::vector<std::uint32_t> rows;
+	};
+
+	// Build the reverse lists of movie to person links
+	reverse invert(const adjacency_column&) const;
+
+	// Call a function with the person rows of an id or a full name
+	template <typename Function>
+	void people(std::string_view person, Function&& f) const;
+
+	// Return the rows of a string column containing a text, in order
+	static std::vector<std::uint32_t> contains(const string_column&, const trigram_index&,
+											   std::string_view text);
+
+	void movie(std::uint32_t row, writer& out) const
+	{ out << std::to_string(movie_id[row]) << '\t' << title[row] << '\n'; }
+
+	static bool parse(std::string_view s, std::uint32_t& id)
+	{
+		const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), id);
+		return error == std::errc() && end == s.data() + s.size();
+	}
+
+	const snapshot data;
+
+	const array_view<std::uint32_t> movie_id, person_id;
+	const string_column title, full_name;
+	const adjacency_column directors, cast;
+
+	hash_index movies_by_id, movies_by_title, people_by_id, people_by_name;
+	reverse directed, acted;
+
+	const string_column original_title;
+	const trigram_index title_grams, original_title_grams, full_name_grams;
+};
+
+engine::engine(const char* path) :
+	data(path),
+	movie_id(data.column<std::uint32_t>("movies.id")),
+	person_id(data.column<std::uint32_t>("people.id")),
+	title(data.strings("movies.title")), full_name(data.strings("people.full_name")),
+	directors(data.adjacency("movies.directors")), cast(data.adjacency("movies.cast")),
+	movies_by_id(movie_id.size), movies_by_title(movie_id.size),
+	people_by_id(person_id.size), people_by_name(person_id.size),
+	original_title(data.strings("movies.original_title")),
+	title_grams(data, "movies.title"), original_title_grams(data, "movies.original_title"),
+	full_name_grams(data, "people.full_name")
+{
+	for (std::uint32_t i = 0; i < movie_id.size; i++)
+	{
+		movies_by_id.insert(movie_id[i], i);
+		movies_by_title.insert(fingerprint(title[i]), i);
+	}
+	for (std::uint32_t i = 0; i < person_id.size; i++)
+	{
+		people_by_id.insert(person_id[i], i);
+		people_by_name.insert(fingerprint(full_name[i]), i);
+	}
+
+	directed = invert(directors);
+	acted = invert(cast);
+}
+
+engine::reverse engine::invert(const adjacency_column& links) const
+{
+	// Person row of every link (or none), counted per person
+	std::vector<std::uint32_t> person(links.ids.size, ~std::uint32_t(0));
+	reverse r;
+	r.offsets.assign(person_id.size + 1, 0);
+	for (std::size_t i = 0; i < links.ids.size; i++)
+		people_by_id.find(links.ids[i], [&](std::uint32_t row)
+		{
+			person[i] = row;
+			r.offsets[row + 1]++;
+		});
+	for (std::size_t i = 1; i < r.offsets.size(); i++) r.offsets[i] += r.offsets[i - 1];
+
+	// Then place the movie rows, in movie order
+	std::vector<std::uint64_t> next(r.offsets.begin(), r.offsets.end() - 1);
+	r.rows.resize(r.offsets.back());
+	for (std::uint32_t m = 0; m < links.size(); m++)
+		for (std::uint64_t i = links.offsets[m]; i < links.offsets[m + 1]; i++)
+			if (person[i] != ~std::uint32_t(0)) r.rows[next[person[i]]++] = m;
+	return r;
+}
+
+template <typename Function>
+void engine::people(std::string_view person, Function&& f) const
+{
+	std::uint32_t id;
+	if (parse(person, id)) people_by_id.find(id, f);
+	else people_by_name.find(fingerprint(person), [&](std::uint32_t row)
+	{
+		if (full_name[row] == person) f(row);
+	});
+}
+
+std::vector<std::uint32_t> engine::contains(const string_column& column, const trigram_index& index,
+											std::string_view text)
+{
+	const std::string pattern = trigram::fold(text);
+	std::vector<std::uint32_t> rows;
+	if (!index || !index.candidates(pattern, rows))
+	{
+		rows.resize(column.size());
+		for (std::uint32_t i = 0; i < rows.size(); i++) rows[i] = i;
+	}
+
+	// Verify candidates
+	rows.erase(std::remove_if(rows.begin(), rows.end(),
+		[&](std::uint32_t row) { return !trigram::contains(column[row], pattern); }), rows.end());
+	return rows;
+}
+
+void engine::query(std::string_view line, writer& out) const
+{
+	const std::size_t space = line.find(' ');
+	const std::string_view command = line.substr(0, space),
+		argument = space == line.npos ? std::string_view() : line.substr(space + 1);
+
+	std::uint32_t id;
+	if (command == "id")
+	{
+		if (parse(argument, id)) movies_by_id.find(id, [&](std::uint32_t row) { movie(row, out); });
+	}
+	else if (command == "title")
+	{
+		movies_by_title.find(fingerprint(argument), [&](std::uint32_t row)
+		{
+			if (title[row] == argument) movie(row, out);
+		});
+	}
+	else if (command == "actor" || command == "director")
+	{
+		const reverse& r = command == "actor" ? acted : directed;
+		people(argument, [&](std::uint32_t person)
+		{
+			for (std::uint64_t i = r.offsets[person]; i < r.offsets[person + 1]; i++) movie(r.rows[i], out);
+		});
+	}
+	else if (command == "person")
+	{
+		people(argument, [&](std::uint32_t row)
+		{
+			out << std::to_string(person_id[row]) << '\t' << full_name[row] << '\n';
+		});
+	}
+	else if (command == "title-contains")
+	{
+		const auto a = contains(title, title_grams, argument),
+			b = contains(original_title, original_title_grams, argument);
+		std::vector<std::uint32_t> rows;
+		std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(rows));
+		for (const std::uint32_t row: rows) movie(row, out);
+	}
+	else if (command == "name-contains")
+	{
+		for (const std::uint32_t row: contains(full_name, full_name_grams, argument))
+			out << std::to_string(person_id[row]) << '\t' << full_name[row] << '\n';
+	}
+	else throw std::invalid_argument("unknown query " + std::string(command));
+
+	out << '\n';
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		if (argc < 2) throw std::invalid_argument("snapshot file expected");
+		const engine search(argv[1]);
+		writer out(STDOUT_FILENO, 1 << 16);
+
+		// Single query from the command line
+		if (argc > 2)
+		{
+			std::string line(argv[2]);
+			for (int i = 3; i < argc; i++) (line += ' ') += argv[i];
+			search.query(line, out);
+			out.flush();
+			return EXIT_SUCCESS;
+		}
+
+		// Query stream, answered line by line
+		line_reader input;
+		for (std::string_view line; input.next(line); out.flush())
+		{
+			try { search.query(line, out); }
+			catch (const std::invalid_argument& e)
+			{
+				std::cerr << argv[0] << " : " << e.what() << '\n';
+				out << '\n';
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << argv[0] << " : " << e.what()
+			<< "\n\nSyntax: " << argv[0] << " SNAPSHOT [id ID|title TITLE|actor ID|NAME"
+			"|director ID|NAME|person ID|NAME|title-contains TEXT|name-contains TEXT]\n";
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,151 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  shards.py
+#
+#  Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+
+"""
+===========================================
+Sharded parallel loading
+===========================================
+
+	shards.py --mysql -n 8 -d movies < movies.txt -- -u root
+	shards.py --postgres -n 8 -d movies --batch 1000 < movies.txt -- -U postgres
+
+Loads the output of split.cpp into a database through N concurrent client
+connections (mysql or psql), without any shell: split.cpp partitions the rows
+into N scripts (see Shards in split.cpp) written to FIFOs, each read by its
+own client as it is produced. Unknown options (e.g. --batch, --dedup, -j) are
+passed on to split.cpp, and the arguments after "--" to every client.
+
+The FIFOs are made in a temporary directory, or in --dir. With --keep, the
+scripts are rather written to regular files in --dir, then loaded.
+
+PostgreSQL scripts disable foreign key checks with session_replication_role,
+which requires a superuser.
+"""
+
+import os
+import sys
+import argparse
+import subprocess
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+def arguments(argv=None):
+	""" Parse the command line: launcher settings, split.cpp options, client arguments """
+	argv = sys.argv[1:] if argv is None else argv
+	client = []
+	if '--' in argv:
+		client = argv[argv.index('--') + 1:]
+		argv = argv[:argv.index('--')]
+
+	parser = argparse.ArgumentParser(description='Load movies.txt through N client connections.')
+	dialect = parser.add_mutually_exclusive_group(required=True)
+	dialect.add_argument('--mysql', dest='dialect', action='store_const', const='mysql')
+	dialect.add_argument('--postgres', dest='dialect', action='store_const', const='postgres')
+	parser.add_argument('-n', '--shards', type=int, default=os.cpu_count(), help='number of connections')
+	parser.add_argument('--split', default=os.path.join(HERE, 'split'), help='split.cpp program')
+	parser.add_argument('--input', help='input file (default: stdin)')
+	parser.add_argument('--dir', help='shard directory (default: temporary)')
+	parser.add_argument('--keep', action='store_true', help='write regular files to --dir, then load them')
+	parser.add_argument('-d', '--database', required=True, help='database name')
+	settings, split_options = parser.parse_known_args(argv)
+	if settings.keep and not settings.dir:
+		parser.error('--keep requires --dir')
+	settings.client = client
+	settings.split_options = split_options
+	return settings
+
+def client(settings):
+	""" Client command line of the selected database """
+	if settings.dialect == 'mysql':
+		return ['mysql'] + settings.client + [settings.database]
+	return ['psql', '-q', '-v', 'ON_ERROR_STOP=1'] + settings.client + ['-d', settings.database]
+
+def split(settings, directory):
+	""" Start split.cpp, writing the shards to a directory """
+	command = [settings.split, '--' + settings.dialect, '--shards', str(settings.shards),
+		'--output-dir', directory] + settings.split_options
+	input = open(settings.input, 'rb') if settings.input else sys.stdin.buffer
+	with input:
+		return subprocess.Popen(command, stdin=input)
+
+def paths(directory, shards):
+	return [os.path.join(directory, 'shard-%d.sql' % k) for k in range(shards)]
+
+def load_streamed(settings, directory):
+	""" Load the shards through FIFOs as split.cpp produces them """
+	readers, writers = [], []
+	for path in paths(directory, settings.shards):
+		if not os.path.exists(path):
+			os.mkfifo(path)
+
+		# Open both ends: the read end without blocking, then a write end kept
+		# until split.cpp exits, so no client reads an early end of file
+		reader = os.open(path, os.O_RDONLY | os.O_NONBLOCK)
+		os.set_blocking(reader, True)
+		readers.append(reader)
+		writers.append(os.open(path, os.O_WRONLY))
+
+	loaders = []
+	try:
+		for reader in readers:
+			loaders.append(subprocess.Popen(client(settings), stdin=reader))
+	finally:
+		for reader in readers:
+			os.close(reader)
+
+	status = split(settings, directory).wait()
+	for writer in writers:
+		os.close(writer)
+	return [status] + [loader.wait() for loader in loaders]
+
+def load_files(settings, directory):
+	""" Write the shards to files, then load them """
+	status = split(settings, directory).wait()
+	if status:
+		return [status]
+
+	loaders = []
+	for path in paths(directory, settings.shards):
+		with open(path, 'rb') as script:
+			loaders.append(subprocess.Popen(client(settings), stdin=script))
+	return [loader.wait() for loader in loaders]
+
+def main(argv=None):
+	settings = arguments(argv)
+	if settings.keep:
+		os.makedirs(settings.dir, exist_ok=True)
+		statuses = load_files(settings, settings.dir)
+	elif settings.dir:
+		os.makedirs(settings.dir, exist_ok=True)
+		statuses = load_streamed(settings, settings.dir)
+	else:
+		with tempfile.TemporaryDirectory() as directory:
+			statuses = load_streamed(settings, directory)
+
+	failed = [s for s in statuses if s]
+	if failed:
+		sys.stderr.write('%s : %d of %d processes failed\n' % (sys.argv[0], len(failed), len(statuses)))
+	return 1 if failed else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
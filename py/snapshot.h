@@ -0,0 +1,381 @@
+/*
+ * snapshot.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cerrno>
+#include <system_error>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "output.h"
+
+/**
+ * \brief Columnar snapshot format
+ *
+ * A snapshot file holds named columns of fixed-width values, e.g. one per
+ * numeric movie field, laid out as plain arrays which are used in place once
+ * the file is memory-mapped:
+ *
+ * - a header: magic "RQSNAP", format version, number of columns, file size
+ * - a directory of column descriptors: name, value type, width, count and
+ *   file offset
+ * - the column arrays, each aligned on 64 bytes, in host byte order
+ *
+ * Composite columns are made of plain ones by naming convention:
+ *
+ * - a string column "x" is the array of the (count + 1) byte offsets of its
+ *   values (u64) into the blob "x.data"
+ * - an adjacency column "x" (compressed sparse rows) is the array of the
+ *   (rows + 1) offsets (u64) of every row into the value array "x.ids"
+ * - the trigram index of a string column "x" is made of "x.grams" and
+ *   "x.postings" (see trigram.h)
+ *
+ * Null values are all-ones integers, NaN floating-point values, or empty
+ * strings.
+ */
+namespace snapshot_format
+{
+	constexpr char magic[8] = { 'R', 'Q', 'S', 'N', 'A', 'P', 0, 0 };
+	constexpr std::uint32_t version = 2;
+	constexpr std::size_t alignment = 64;
+
+	enum type : std::uint32_t { u8, u32, u64, f32, f64, bytes };
+
+	struct header
+	{
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t columns;
+		std::uint64_t file_size;
+	};
+
+	struct descriptor
+	{
+		char name[40];
+		std::uint32_t type;
+		std::uint32_t width;
+		std::uint64_t count;
+		std::uint64_t offset;
+	};
+
+	// Value type code of a C++ type
+	template <typename T> constexpr type type_of();
+	template <> constexpr type type_of<std::uint8_t>() { return u8; }
+	template <> constexpr type type_of<std::uint32_t>() { return u32; }
+	template <> constexpr type type_of<std::uint64_t>() { return u64; }
+	template <> constexpr type type_of<float>() { return f32; }
+	template <> constexpr type type_of<double>() { return f64; }
+	template <> constexpr type type_of<char>() { return bytes; }
+}
+
+/// Read-only view of an array, e.g. a mapped column
+template <typename T>
+struct array_view
+{
+	const T* data = nullptr;
+	std::size_t size = 0;
+
+	const T& operator [] (std::size_t i) const { return data[i]; }
+	const T* begin() const { return data; }
+	const T* end() const { return data + size; }
+};
+
+/// String column: value i is data[offsets[i], offsets[i + 1])
+struct string_column
+{
+	array_view<std::uint64_t> offsets;
+	array_view<char> data;
+
+	std::size_t size() const { return offsets.size ? offsets.size - 1 : 0; }
+	std::string_view operator [] (std::size_t i) const
+	{ return { data.data + offsets[i], offsets[i + 1] - offsets[i] }; }
+};
+
+/// Adjacency column: row i is ids[offsets[i], offsets[i + 1])
+struct adjacency_column
+{
+	array_view<std::uint64_t> offsets;
+	array_view<std::uint32_t> ids;
+
+	std::size_t size() const { return offsets.size ? offsets.size - 1 : 0; }
+	array_view<std::uint32_t> operator [] (std::size_t i) const
+	{ return { ids.data + offsets[i], offsets[i + 1] - offsets[i] }; }
+};
+
+/**
+ * \brief Snapshot reader
+ *
+ * Maps a snapshot file and checks its header and directory: opening costs a
+ * few system calls whatever the file size, and columns are read in place
+ * (pages are loaded upon first access).
+ *
+ *	snapshot s("movies.snap");
+ *	const auto title = s.strings("movies.title");
+ *	const auto cast = s.adjacency("movies.cast");
+ *	for (const std::uint32_t actor: cast[0]) ...
+ */
+class snapshot
+{
+public:
+	explicit snapshot(const char* path);
+	~snapshot();
+
+	snapshot(const snapshot&) = delete;
+	snapshot& operator = (const snapshot&) = delete;
+
+	// Column directory
+	array_view<snapshot_format::descriptor> columns() const { return directory; }
+
+	// Whether the snapshot has a given column
+	bool has(std::string_view name) const { return find(name) != nullptr; }
+
+	// Typed column, string column and adjacency column by name: throw if
+	// missing or of another type
+	template <typename T>
+	array_view<T> column(std::string_view name) const;
+
+	string_column strings(std::string_view name) const
+	{
+		const auto data = column<char>(std::string(name) + ".data");
+		return { offsets(name, data.size), data };
+	}
+
+	adjacency_column adjacency(std::string_view name) const
+	{
+		const auto ids = column<std::uint32_t>(std::string(name) + ".ids");
+		return { offsets(name, ids.size), ids };
+	}
+
+private:
+	const snapshot_format::descriptor* find(std::string_view name) const;
+
+	// Offsets of a string or adjacency column, which must be non-decreasing
+	// up to its number of values: throw otherwise
+	array_view<std::uint64_t> offsets(std::string_view name, std::size_t values) const;
+
+	void* map = nullptr;
+	std::size_t map_size = 0;
+	array_view<snapshot_format::descriptor> directory;
+};
+
+inline snapshot::snapshot(const char* path)
+{
+	using namespace snapshot_format;
+
+	const int fd = ::open(path, O_RDONLY);
+	if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+
+	struct stat st;
+	if (::fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		map_size = st.st_size;
+		map = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	const int error = errno;
+	::close(fd);
+	if (!map || map == MAP_FAILED)
+	{
+		map = nullptr;
+		throw std::system_error(error, std::generic_category(), path);
+	}
+
+	// Check the header, then that every column lies within the file
+	const char* base = static_cast<const char*>(map);
+	const header* h = static_cast<const header*>(map);
+	bool valid = map_size >= sizeof(header) && !std::memcmp(h->magic, magic, sizeof magic)
+		&& h->file_size == map_size
+		&& (map_size - sizeof(header)) / sizeof(descriptor) >= h->columns;
+
+	if (valid && h->version != version)
+	{
+		const std::uint32_t found = h->version;
+		::munmap(map, map_size);
+		throw std::runtime_error(std::string(path) + ": unsupported snapshot version "
+			+ std::to_string(found));
+	}
+
+	if (valid)
+	{
+		directory = { reinterpret_cast<const descriptor*>(base + sizeof(header)), h->columns };
+		for (const descriptor& c: directory)
+			valid = valid && c.offset % alignment == 0 && c.offset <= map_size
+				&& c.count <= (map_size - c.offset) / (c.width ? c.width : 1)
+				&& std::memchr(c.name, 0, sizeof c.name);
+	}
+
+	if (!valid)
+	{
+		::munmap(map, map_size);
+		throw std::runtime_error(std::string(path) + ": not a snapshot");
+	}
+}
+
+inline snapshot::~snapshot()
+{
+	if (map) ::munmap(map, map_size);
+}
+
+inline const snapshot_format::descriptor* snapshot::find(std::string_view name) const
+{
+	for (const auto& c: directory)
+		if (name == c.name) return &c;
+	return nullptr;
+}
+
+template <typename T>
+array_view<T> snapshot::column(std::string_view name) const
+{
+	const auto* c = find(name);
+	if (!c || c->type != snapshot_format::type_of<T>() || c->width != sizeof(T))
+		throw std::runtime_error("snapshot: no " + std::string(name) + " column of that type");
+	return { reinterpret_cast<const T*>(static_cast<const char*>(map) + c->offset), c->count };
+}
+
+inline array_view<std::uint64_t> snapshot::offsets(std::string_view name, std::size_t values) const
+{
+	const auto o = column<std::uint64_t>(name);
+	bool valid = !o.size || o[o.size - 1] <= values;
+	for (std::size_t i = 1; valid && i < o.size; i++) valid = o[i - 1] <= o[i];
+	if (!valid) throw std::runtime_error("snapshot: " + std::string(name) + ": not a snapshot");
+	return o;
+}
+
+/**
+ * \brief Snapshot writer
+ *
+ * Collects references to column arrays, which must live until save() writes
+ * the directory and every column to a file. String and adjacency columns are
+ * built row by row.
+ */
+class snapshot_builder
+{
+public:
+	struct strings
+	{
+		std::vector<std::uint64_t> offsets{0};
+		std::string data;
+
+		void push(std::string_view value)
+		{
+			data += value;
+			offsets.push_back(data.size());
+		}
+	};
+
+	struct adjacency
+	{
+		std::vector<std::uint64_t> offsets{0};
+		std::vector<std::uint32_t> ids;
+
+		// End the current row
+		void next() { offsets.push_back(ids.size()); }
+	};
+
+	template <typename T>
+	void column(const std::string& name, const std::vector<T>& values)
+	{ add(name, snapshot_format::type_of<T>(), sizeof(T), values.size(), values.data()); }
+
+	void column(const std::string& name, const std::string& blob)
+	{ add(name, snapshot_format::bytes, 1, blob.size(), blob.data()); }
+
+	void column(const std::string& name, const strings& s)
+	{
+		column(name, s.offsets);
+		column(name + ".data", s.data);
+	}
+
+	void column(const std::string& name, const adjacency& a)
+	{
+		column(name, a.offsets);
+		column(name + ".ids", a.ids);
+	}
+
+	void save(const char* path) const;
+
+private:
+	void add(const std::string& name, snapshot_format::type, std::size_t width,
+			 std::size_t count, const void* data);
+
+	std::vector<snapshot_format::descriptor> directory;
+	std::vector<const void*> data;
+};
+
+inline void snapshot_builder::add(const std::string& name, snapshot_format::type type,
+								  std::size_t width, std::size_t count, const void* values)
+{
+	snapshot_format::descriptor c{};
+	if (name.size() >= sizeof c.name)
+		throw std::length_error("snapshot column name too long: " + name);
+	name.copy(c.name, name.size());
+	c.type = type;
+	c.width = width;
+	c.count = count;
+	directory.push_back(c);
+	data.push_back(values);
+}
+
+inline void snapshot_builder::save(const char* path) const
+{
+	using namespace snapshot_format;
+
+	// Lay columns out after the directory
+	std::vector<descriptor> columns(directory);
+	std::uint64_t end = sizeof(header) + columns.size() * sizeof(descriptor);
+	for (auto& c: columns)
+	{
+		c.offset = (end + alignment - 1) / alignment * alignment;
+		end = c.offset + c.count * c.width;
+	}
+
+	header h{};
+	std::memcpy(h.magic, magic, sizeof magic);
+	h.version = version;
+	h.columns = columns.size();
+	h.file_size = end;
+
+	writer file{std::string(path)};
+	file.write(reinterpret_cast<const char*>(&h), sizeof h);
+	file.write(reinterpret_cast<const char*>(columns.data()), columns.size() * sizeof(descriptor));
+
+	std::uint64_t at = sizeof(header) + columns.size() * sizeof(descriptor);
+	static const char padding[alignment] = {};
+	for (std::size_t i = 0; i < columns.size(); i++)
+	{
+		file.write(padding, columns[i].offset - at);
+		file.write(static_cast<const char*>(data[i]), columns[i].count * columns[i].width);
+		at = columns[i].offset + columns[i].count * columns[i].width;
+	}
+	file.close();
+}
+
+
+#endif /* if __SNAPSHOT_H__ */
@@ -48,28 +48,75 @@
 
 #include <stdlib.h>			// For EXIT_(SUCCESS|FAILURE)
 #include <iostream>
-#include <iomanip>			// For std::quoted()
 #include <cstring>
 #include <vector>
-#include <algorithm>		// For copy/copy_if
-#include "iterators.h"
+#include <array>
+#include <memory_resource>	// For the per-line arena
+#include <memory>			// For std::unique_ptr
+#include <cstdint>
+#include <charconv>			// For std::from_chars()/to_chars()
+#include <optional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+#include <algorithm>		// For find/lower_bound
+#include <limits>
+#include <type_traits>
+#include "hashset.h"
+#include "input.h"
+#include "scan.h"
+#include "output.h"
+#include "stats.h"
+#include "state.h"
+#include "snapshot.h"
+#include "trigram.h"
+#include "validate.h"
+
+#ifdef SPLIT_SQLITE
+#include <sqlite3.h>		// Optional SQLite database output (-lsqlite3)
+#endif
 
 static_assert(__cplusplus >= 201703L, "compile option -std=c++17 is required.");
 
-// Separators
-static constexpr char DOUBLE_VLINE[] = "\u2016";
-static constexpr char TRIANGLE_BULLET[] = "\u2023";
-static constexpr char DOT_LEADER[] = "\u2024";
+#ifdef SPLIT_COUNT_ALLOCATIONS
+#include <atomic>
 
 /**
- * \brief Quote a string for database insertion
+ * \brief Heap allocation counter
  *
- * The STL provides a generic way to quote strings while escaping the quote
- * sign. Default database quoting doubles the quote mark, a single quote char.
+ * Debug builds (-DSPLIT_COUNT_ALLOCATIONS) count every operator new call, and
+ * a serial import fails if lines allocate memory past a warm-up of 1000 lines
+ * (the reused buffers growing to the size of the largest line aside), e.g.:
+ *
+ *	g++ -std=c++17 -DSPLIT_COUNT_ALLOCATIONS -o split split.cpp
+ *	./split --mysql --input movies.txt >/dev/null
+ *
+ * Every streamed output passes, batched or not (see AllocationTest in
+ * test_import.py). Snapshots and fingerprint indexes (--state) keep the
+ * whole import in arrays, which allocate whenever they double.
  */
-template <typename T>
-auto quote(T& value)
-{ return std::quoted(value, '\'', '\''); }
+static std::atomic<std::size_t> allocations{0};
+
+// GCC mistakes the replaced operators below for mismatched malloc/delete
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(std::size_t n)
+{
+	allocations++;
+	if (void* p = std::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+// Separators
+static constexpr char DOUBLE_VLINE[] = "\u2016";
+static constexpr char TRIANGLE_BULLET[] = "\u2023";
+static constexpr char DOT_LEADER[] = "\u2024";
 
 /**
  * \brief Field delimiter
@@ -85,7 +132,8 @@ typedef std::string_view delimiter;
  * \brief Raw record field iterator
  *
  * This forward-only iterator returns a string view from a raw record string
- * on every invocation.
+ * on every invocation. Delimiters are searched with the vectorized kernels
+ * from scan.h.
  *
  * Note: This is not a fully STL-compliant iterator.
  */
@@ -99,34 +147,34 @@ struct splitter
 	std::size_t begin, end;
 
 	// Build an iterator for the given line and delimiter
-	constexpr splitter(std::string_view, const delimiter&);
+	splitter(std::string_view, const delimiter&);
 
 	// Return a string view using the current markers
 	constexpr std::string_view operator * () const
 	{ return { &record[begin], end-begin }; }
 
 	// Increment operators
-	constexpr splitter& operator ++ ();		// Pre-increment
-	constexpr splitter operator ++ (int);	// Post-increment
+	splitter& operator ++ ();		// Pre-increment
+	splitter operator ++ (int);	// Post-increment
 };
 
-inline constexpr splitter::splitter(std::string_view _s, const delimiter& _delimiter) :
+inline splitter::splitter(std::string_view _s, const delimiter& _delimiter) :
 		record(_s), mark(_delimiter),
-		begin(0), end(std::min(record.find(mark), record.size())) {}
+		begin(0), end(std::min(scan::find(record, mark), record.size())) {}
 
-inline constexpr splitter& splitter::operator ++ ()
+inline splitter& splitter::operator ++ ()
 {
 	// Don't search past the end of the record string
 	const std::size_t length = record.length();
 	if (begin < length)
 	{
 		const std::size_t next_stop = std::min(end + mark.size(), length);
-		end = std::min(record.find(mark, begin = next_stop), length);
+		end = std::min(scan::find(record, mark, begin = next_stop), length);
 	}
 	return *this;
 }
 
-inline constexpr splitter splitter::operator ++ (int)
+inline splitter splitter::operator ++ (int)
 {
 	splitter tmp = *this;
 	operator ++ ();
@@ -155,6 +203,119 @@ constexpr auto raw_director_fields = {
 static const delimiter movie_delimiter(TRIANGLE_BULLET);
 static const delimiter record_delimiter(DOUBLE_VLINE);
 static const delimiter value_delimiter(DOT_LEADER);
+static const delimiter list_delimiter(",");
+
+/**
+ * \brief Structural index of a movie line
+ *
+ * A single pass over the line (see scan::marks) sets the positions of all
+ * three delimiters in bitmaps, one per level: movie fields, records (genres,
+ * directors, actors) or record values. Nested fields are then split by
+ * looking the next bit up instead of searching the same bytes again, which
+ * matters most for the long cast field.
+ *
+ * Each 64 bytes of the line take a word per level, the words of a level being
+ * interleaved with the others to share cache lines. The index is reused from
+ * one line to another.
+ */
+struct structure
+{
+	enum level : std::size_t { movie_level, record_level, value_level };
+
+	std::string_view line;
+	std::vector<std::uint64_t> bits;
+
+	void build(std::string_view);
+
+	// Bitmap word of a level covering a given position
+	std::uint64_t word(std::size_t pos, level l) const { return bits[3 * (pos / 64) + l]; }
+};
+
+void structure::build(std::string_view _line)
+{
+	// All delimiters share their first two bytes, which the last one tells
+	// apart, in level order
+	static constexpr char last[] = { TRIANGLE_BULLET[2], DOUBLE_VLINE[2], DOT_LEADER[2] };
+
+	line = _line;
+	bits.resize(3 * (line.size() / 64 + 1));
+	scan::marks(line, TRIANGLE_BULLET, last, bits.data());
+}
+
+/**
+ * \brief Indexed field iterator
+ *
+ * Same as splitter, only the delimiter positions of a given level are read
+ * from the structural index of the line the split string belongs to.
+ */
+struct indexed_splitter
+{
+	// Raw record view
+	const std::string_view record;
+
+	// Field value start and end positions
+	std::size_t begin, end;
+
+	// Build an iterator for the given part of an indexed line
+	indexed_splitter(const structure&, std::string_view, structure::level);
+
+	// Return a string view using the current markers
+	std::string_view operator * () const
+	{ return record.substr(begin, end - begin); }
+
+	// Increment operators
+	indexed_splitter& operator ++ ();		// Pre-increment
+	indexed_splitter operator ++ (int);	// Post-increment
+
+private:
+	// Move to the next delimiter of the right level within the record
+	void next_mark();
+
+	const structure& index;
+	const structure::level level;
+	const std::size_t base, limit;
+
+	// Position of the current bitmap word, and its delimiters left
+	std::size_t word;
+	std::uint64_t mask;
+};
+
+inline indexed_splitter::indexed_splitter(const structure& s, std::string_view _s,
+										  structure::level _level) :
+		record(_s), begin(0), end(0), index(s), level(_level),
+		base(_s.data() - s.line.data()), limit(base + record.size()),
+		word(base / 64 * 64), mask(s.word(base, level) & ~std::uint64_t(0) << base % 64)
+{
+	next_mark();
+}
+
+inline void indexed_splitter::next_mark()
+{
+	// Skip the words without a delimiter of that level, e.g. along the cast
+	while (!mask && (word += 64) < limit) mask = index.word(word, level);
+	const std::size_t pos = mask ? word + __builtin_ctzll(mask) : limit;
+	mask &= mask - 1;
+	end = std::min(pos, limit) - base;
+}
+
+inline indexed_splitter& indexed_splitter::operator ++ ()
+{
+	// Don't go past the end of the record string
+	const std::size_t length = record.length();
+	if (begin < length)
+	{
+		begin = std::min(end + movie_delimiter.size(), length);
+		next_mark();
+	}
+	return *this;
+}
+
+inline indexed_splitter indexed_splitter::operator ++ (int)
+{
+	indexed_splitter tmp = *this;
+	operator ++ ();
+	return tmp;
+}
 
 /**
  * \brief Generic record
@@ -167,7 +328,7 @@ static const delimiter value_delimiter(DOT_LEADER);
 struct record
 {
 	typedef std::string::value_type char_type;
-	typedef std::initializer_list<const char_type* const> name_list;
+	typedef std::initializer_list<const char_type*> name_list;
 
 	// Record field aka key/value pair
 	struct field
@@ -190,163 +351,635 @@ struct record
 		operator value_type () const { return value; }
 	};
 
-	// Range of record fields
-	template <typename T>
-	struct range
-	{
-		const field *start, *end;
-		typedef T value_type;
-	};
-
+	// Maximum number of fields, i.e. those of a movie line
+	static constexpr std::size_t capacity = 15;
 
-	// Name & value ranges, used by output stream iterators
-	typedef range<field::name_type> name_range;
-	typedef range<field::value_type> value_range;
-
-	// List of field names and markers
-	std::vector<field> fields;
+	// List of field names and markers, stored inline: building a record, even
+	// a short-lived one, doesn't allocate
+	std::array<field, capacity> fields;
+	std::size_t count;
 
 	// Construct a blank record using a field name list
-	record(const name_list& list) :
-		fields(list.begin(), list.end()) {}
+	record(const name_list& list) : count(check(list.size()))
+	{ std::copy(list.begin(), list.end(), fields.begin()); }
 
 	// Construct an initialized record
-	record(std::initializer_list<field>&& list) : fields(list) {}
-
-	// Return a range of iterators for field names
-	static name_range names(const record&, int first = 0);
-	static name_range names(const record&, int first, int last);
-
-	// Return a range of value iterators
-	static value_range values(const record&, int first = 0);
-	static value_range values(const record&, int first, int last);
+	record(std::initializer_list<field>&& list) : count(check(list.size()))
+	{ std::copy(list.begin(), list.end(), fields.begin()); }
 
 	// Return the number of fields in this record
-	std::size_t size() const { return fields.size(); }
+	std::size_t size() const { return count; }
 
 	// Split the record line into the expected field values
 	std::size_t parse(const std::string_view&, const delimiter&);
 
+	// Same, walking the structural index of the line
+	std::size_t parse(const structure&, const std::string_view&, structure::level);
+
 	// Field access shortcut
 	const field& operator [] (int index) const
-	{ return fields[index < 0 ? fields.size() + index : index]; }
+	{ return fields[index < 0 ? count + index : index]; }
 
 	field& operator [] (int index)
-	{ return fields[index < 0 ? fields.size() + index : index]; }
+	{ return fields[index < 0 ? count + index : index]; }
+
+private:
+	static std::size_t check(std::size_t n)
+	{
+		if (n > capacity) throw std::length_error("too many record fields");
+		return n;
+	}
 };
 
 std::size_t record::parse(const std::string_view& _str, const delimiter& _delimiter)
 {
 	splitter iterator(_str, _delimiter);
-	for (auto& field: fields) field.value = *iterator++;
-	return fields.size();
+	for (std::size_t i = 0; i < count; i++) fields[i].value = *iterator++;
+	return count;
+}
+
+std::size_t record::parse(const structure& _index, const std::string_view& _str,
+						  structure::level _level)
+{
+	indexed_splitter iterator(_index, _str, _level);
+	for (std::size_t i = 0; i < count; i++) fields[i].value = *iterator++;
+	return count;
 }
 
-inline record::name_range record::names(const record& r, int first)
-{ return names(r, first, r.size()); }
+/**
+ * \brief Table schemas
+ *
+ * The target tables are compile-time types, made of a name and a list of
+ * columns, from which the constant head of an INSERT statement is rendered at
+ * compile time for every SQL dialect (see insert_head). Row values are passed
+ * as a fixed-size array in column order, hence the per-row work reduces to
+ * writing values out.
+ *
+ * Columns of empty values are skipped: the non-empty values of a row make a
+ * bitmask of the present columns, which selects the matching statement head
+ * (unless rows are batched, see DB).
+ */
+namespace schema
+{
+	/**
+	 * Column constraint, as declared in mysql/CreateCB.sql: maximum length in
+	 * characters (VARCHAR, 0 if none), whether a value is required (NOT NULL
+	 * CHECK (LENGTH(x) > 0)) and the members of an ENUM, if any
+	 */
+	struct constraint
+	{
+		std::size_t length = 0;
+		bool required = false;
+		const std::string_view* members = nullptr;
+		std::size_t count = 0;
+	};
+
+	constexpr std::string_view statuses[] = {
+		"Released", "Planned", "In Production", "Post Production", "Canceled", "Rumored"
+	};
+
+	constexpr std::string_view certifications[] = {
+		"G", "PG", "PG-13", "R", "NC-17", "X", "NR", "UR"
+	};
+
+	struct movies
+	{
+		static constexpr char name[] = "movies";
+		static constexpr const char* columns[] = {
+			"id", "title", "original_title", "release_date", "status",
+			"vote_average", "vote_count", "runtime", "certification",
+			"poster_path", "budget", "tag_line", "genre"
+		};
+		static constexpr constraint constraints[] = {
+			{}, { 63, true }, { 63 }, {}, { 0, false, statuses, std::size(statuses) },
+			{}, {}, {}, { 0, false, certifications, std::size(certifications) },
+			{}, {}, { 79 }, {}
+		};
+	};
+
+	struct people
+	{
+		static constexpr char name[] = "people";
+		static constexpr const char* columns[] = { "id", "full_name" };
+		static constexpr constraint constraints[] = { {}, { 31, true } };
+	};
+
+	struct directors
+	{
+		static constexpr char name[] = "directors";
+		static constexpr const char* columns[] = { "movie_id", "director_id" };
+		static constexpr constraint constraints[] = { {}, {} };
+	};
+
+	struct characters
+	{
+		static constexpr char name[] = "characters";
+		static constexpr const char* columns[] = { "movie_id", "actor_id", "character_name" };
+		static constexpr constraint constraints[] = { {}, {}, { 31 } };
+	};
+
+	// Number of columns of a table, and bitmask of all of them
+	template <typename Table>
+	constexpr std::size_t size = std::size(Table::columns);
+
+	template <typename Table>
+	constexpr unsigned all = (1u << size<Table>) - 1;
+
+	// Row values, in column order
+	template <typename Table>
+	using row = std::array<std::string_view, size<Table>>;
+
+	// Bitmask of the columns of non-empty values
+	template <typename Table>
+	inline unsigned present(const row<Table>& values)
+	{
+		unsigned mask = 0;
+		for (std::size_t i = 0; i < values.size(); i++)
+			mask |= unsigned(!values[i].empty()) << i;
+		return mask;
+	}
+
+	// Index of a column, or -1 if the table has none such
+	template <typename Table>
+	constexpr int column(std::string_view name)
+	{
+		for (std::size_t i = 0; i < size<Table>; i++)
+			if (name == Table::columns[i]) return i;
+		return -1;
+	}
 
-inline record::name_range record::names(const record& r, int first, int last)
-{ return { &r[first], &r[last] }; }
+	// Violations of a column constraint by a value
+	enum violation { none, too_long, not_member, missing };
+
+	inline violation check(const constraint& c, std::string_view value)
+	{
+		if (value.empty()) return c.required ? missing : none;
+		if (c.length && value.size() > c.length && utf8::length(value) > c.length) return too_long;
+		if (c.members && std::find(c.members, c.members + c.count, value) == c.members + c.count)
+			return not_member;
+		return none;
+	}
 
-inline record::value_range record::values(const record& r, int first)
-{ return values(r, first, r.size()); }
+	/**
+	 * Check the values of a row against the table constraints, counting the
+	 * violations which reject the row: return whether the row is accepted
+	 * (see validation)
+	 */
+	template <typename Table>
+	bool accept(const row<Table>& values, validation& v)
+	{
+		bool accepted = true;
+		for (std::size_t i = 0; i < values.size(); i++)
+		{
+			const violation e = check(Table::constraints[i], values[i]);
+			if (e == none || (v.fix && e != missing)) continue;
+			v.at<Table>(i).rejected++;
+			accepted = false;
+		}
+		return accepted;
+	}
 
-inline record::value_range record::values(const record& r, int first, int last)
-{ return { &r[first], &r[last] }; }
+	// Truncate the overlong values of an accepted row and null its values
+	// which are not ENUM members, counting them
+	template <typename Table>
+	void fix(row<Table>& values, validation& v)
+	{
+		for (std::size_t i = 0; i < values.size(); i++)
+		{
+			const constraint& c = Table::constraints[i];
+			switch (check(c, values[i]))
+			{
+			case too_long:
+				values[i] = values[i].substr(0, utf8::prefix(values[i], c.length));
+				v.at<Table>(i).truncated++;
+				break;
+			case not_member:
+				values[i] = {};
+				v.at<Table>(i).nulled++;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
 
+// Genre column, a set of genres (see genre_set)
+static constexpr char genre_column[] = "genre";
 
 /**
- * \brief Record view, aka read-only record slice
+ * \brief Movie genre set
  *
- * This class provides a read-only slice, i.e. a range of fields from a record
- * in a way similar to std::string_view. Record views are used to print out
- * entire records or a range of contiguous fields.
- *
- * Instances of this class are trivially copyable hence shouldn't need copy
- * or move constructors.
+ * Genres are the 19 members of the MySQL SET column of movies, member i being
+ * bit i of a SET value in order of declaration (see mysql/CreateCB.sql). Genre
+ * names are mapped to their bit with a perfect hash, i.e. a seeded FNV-1a hash
+ * whose seed is searched at compile time so that no two names share a slot of
+ * the lookup table: a lookup is a single hash and comparison. Other names are
+ * unknown genres, which the server would reject.
  */
-struct record_view
+namespace genre_set
 {
-	typedef record::name_range name_range;
-	typedef record::value_range value_range;
+	constexpr std::string_view names[] = {
+		"Thriller", "Family", "TV Movie", "Western", "Science Fiction",
+		"Drama", "Action", "Crime", "Romance", "Animation", "Documentary",
+		"History", "War", "Fantasy", "Music", "Comedy", "Horror",
+		"Mystery", "Adventure"
+	};
+
+	// Lookup table size, as a number of bits
+	constexpr unsigned slot_bits = 6;
+
+	constexpr unsigned hash(std::string_view s, std::uint32_t seed)
+	{
+		std::uint32_t h = 2166136261u ^ seed;
+		for (const char c: s)
+		{
+			h ^= std::uint8_t(c);
+			h *= 16777619u;
+		}
+		return h >> (32 - slot_bits);
+	}
 
-	const record& view;
-	int begin, end;
+	// First seed without collision
+	constexpr std::uint32_t find_seed()
+	{
+		for (std::uint32_t seed = 0;; seed++)
+		{
+			std::uint64_t used = 0;
+			for (const auto name: names) used |= std::uint64_t(1) << hash(name, seed);
+			if (__builtin_popcountll(used) == std::size(names)) return seed;
+		}
+	}
 
-	name_range names() const { return record::names(view, begin, end); }
-	value_range values() const { return record::values(view, begin, end); }
+	constexpr std::uint32_t seed = find_seed();
 
-	record_view(const record& r, int first = 0) :
-		view(r), begin(first), end(r.size()) {}
+	// Member index of every slot, or -1
+	constexpr std::array<std::int8_t, 1 << slot_bits> make_slots()
+	{
+		std::array<std::int8_t, 1 << slot_bits> slots{};
+		for (auto& slot: slots) slot = -1;
+		for (std::size_t i = 0; i < std::size(names); i++) slots[hash(names[i], seed)] = i;
+		return slots;
+	}
 
-	constexpr record_view(const record& r, int first, int last) :
-		view(r), begin(first), end(last) {}
-};
+	constexpr auto slots = make_slots();
+
+	// Return the member index of a genre name, or -1 if unknown
+	constexpr int find(std::string_view name)
+	{
+		const int i = slots[hash(name, seed)];
+		return i >= 0 && names[i] == name ? i : -1;
+	}
+
+	static_assert(find("Science Fiction") == 4 && find("Adventure") == 18 && find("Foreign") < 0);
+
+	// Append the member names of a set value, separated with commas
+	inline void join(std::uint32_t set, std::pmr::string& out)
+	{
+		for (const char* separator = ""; set; set &= set - 1, separator = ",")
+			(out += separator) += names[__builtin_ctz(set)];
+	}
+}
+
+/**
+ * \brief INSERT statement head
+ *
+ * Render "<verb><table>(<columns>) VALUES " for a dialect (i.e. its INSERT
+ * verb, e.g. "INSERT IGNORE ") and a column bitmask, or only compute the size
+ * if the output buffer is null.
+ */
+template <typename Dialect, typename Table>
+constexpr std::size_t render_head(char* out, unsigned mask)
+{
+	std::size_t n = 0;
+	const auto put = [&](const char* s) { for (; *s; s++, n++) if (out) out[n] = *s; };
+
+	put(Dialect::verb);
+	put(Table::name);
+	put("(");
+	for (std::size_t i = 0, first = n; i < schema::size<Table>; i++)
+	{
+		if (!(mask >> i & 1)) continue;
+		if (n != first) put(", ");
+		put(Table::columns[i]);
+	}
+	put(") VALUES ");
+	return n;
+}
 
+/// Head of an INSERT statement of all columns, rendered at compile time
+template <typename Dialect, typename Table>
+constexpr auto full_head()
+{
+	std::array<char, render_head<Dialect, Table>(nullptr, schema::all<Table>)> head{};
+	render_head<Dialect, Table>(head.data(), schema::all<Table>);
+	return head;
+}
+
+/// Head of an INSERT statement for the given columns
+template <typename Dialect, typename Table>
+std::string_view insert_head(unsigned mask)
+{
+	static constexpr auto head = full_head<Dialect, Table>();
+	if (mask == schema::all<Table>) return { head.data(), head.size() };
+
+	// Heads of the other column subsets, rendered once for all threads
+	static const std::vector<std::string> heads = []()
+	{
+		std::vector<std::string> heads(schema::all<Table>);
+		for (unsigned m = 0; m < heads.size(); m++)
+		{
+			heads[m].resize(render_head<Dialect, Table>(nullptr, m));
+			render_head<Dialect, Table>(heads[m].data(), m);
+		}
+		return heads;
+	}();
+	return heads[mask];
+}
 
 /**
- * \brief Quote field values when printed out
+ * \brief Upsert clause
  *
- * The custom function \c quote calls std::quoted internally to use single
- * quote marks and escape single quotes by doubling them.
+ * Render the conflict clause which turns an INSERT statement of a row into an
+ * update of the existing row of the same key (the first column), e.g. "ON
+ * DUPLICATE KEY UPDATE" in MySQL: columns of the row are set to the inserted
+ * values, other columns to NULL. Dialects provide the clause head, split
+ * around the key column if named, and the reference to an inserted value,
+ * split around the column name. Compute the size only if the output is null.
  */
-inline std::ostream& operator << (std::ostream& os, const record::field::value_type& v)
-{ return os << quote(v); }
+template <typename Dialect, typename Table>
+constexpr std::size_t render_update(char* out, unsigned mask)
+{
+	std::size_t n = 0;
+	const auto put = [&](const char* s) { for (; *s; s++, n++) if (out) out[n] = *s; };
+
+	put(Dialect::conflict[0]);
+	if (Dialect::conflict[1])
+	{
+		put(Table::columns[0]);
+		put(Dialect::conflict[1]);
+	}
+	for (std::size_t i = 1; i < schema::size<Table>; i++)
+	{
+		if (i > 1) put(", ");
+		put(Table::columns[i]);
+		put(" = ");
+		if (!(mask >> i & 1)) put("NULL");
+		else
+		{
+			put(Dialect::inserted[0]);
+			put(Table::columns[i]);
+			put(Dialect::inserted[1]);
+		}
+	}
+	return n;
+}
+
+/// Upsert clause for the given columns, rendered once for all threads
+template <typename Dialect, typename Table>
+const char* upsert_tail(unsigned mask)
+{
+	static const std::vector<std::string> tails = []()
+	{
+		std::vector<std::string> tails(schema::all<Table> + 1);
+		for (unsigned m = 0; m < tails.size(); m++)
+		{
+			tails[m].resize(render_update<Dialect, Table>(nullptr, m));
+			render_update<Dialect, Table>(tails[m].data(), m);
+		}
+		return tails;
+	}();
+	return tails[mask].c_str();
+}
 
 /**
- * \brief Output a range of names or values
+ * \brief Output a row of values
  *
- * Use this external serialization operator to output a specific range of names
- * from a given record. Internally uses a custom output stream iterator that
- * joins every value with commas.
+ * Non-empty values are parenthesized and joined with commas, quoted with
+ * single quote marks, single quotes within being escaped by doubling them.
+ * Values of the columns in a given bitmask are numbers, written unquoted.
+ * Empty values are skipped, or written as NULL if requested.
  */
-template <typename T>
-inline std::ostream& operator << (std::ostream& os, const record::range<T>& range)
+template <std::size_t N>
+inline writer& write_values(writer& out, const std::array<std::string_view, N>& values,
+							unsigned numbers = 0, bool nulls = false)
 {
-	std::copy_if(range.start, range.end,
-		ostream_iterator<T>(os, ", "),
-		[](const record::field& f) { return !f.is_empty(); }
-	);
-	return os;
+	const char* separator = "(";
+	for (std::size_t i = 0; i < N; i++)
+	{
+		if (values[i].empty() && !nulls) continue;
+		out << separator;
+		if (values[i].empty()) out << "NULL";
+		else if (numbers >> i & 1) out << values[i];
+		else out.quoted(values[i]);
+		separator = ", ";
+	}
+	return out << (*separator == '(' ? "()" : ")");
 }
 
 /**
- * \brief Database syntax interface
+ * \brief Database syntax base
+ *
+ * Database formatters output SQL instructions, e.g. in MySQL and PostgreSQL
+ * syntaxes. They are distinct types rather than derivatives of an interface:
+ * the importer is a template over the formatter type, hence insertions are
+ * plain (inlined) calls. Every formatter provides:
  *
- * This class defines an interface to output SQL instructions. Derivatives
- * include MySQL and PostgreSQL syntaxes.
+ * - use(), the USE clause
+ * - list(), a genre set formatter (e.g. MySQL SET, implemented as arrays in
+ *   Postgres)
+ * - insert<Table>(), an SQL INSERT statement for a row of a given table
+ * - flush(), to output pending rows at the end of the input
  *
- * The required operations are:
+ * Formatters of SQL statements are also \c incremental, i.e. they provide
+ * upsert<Table>() to update an existing row (see upsert_tail) and remove(),
+ * a DELETE statement by key (see delta).
  *
- * - The USE clause
- * - A field list formatter (e.g. MySQL SET, implemented as arrays in Postgres)
- * - An SQL INSERT statement operation for a given record view
+ * Batched mode: when \c batch_rows is greater than 1, rows are queued through
+ * write() and every queue is output as one multi-row INSERT statement with up
+ * to \c batch_rows rows and \c max_statement bytes. Empty values are then
+ * written as NULL rather than skipped, so that all the rows of a table share
+ * its full statement head: there is one queue per table (and tail, i.e. one
+ * for inserts and one for upserts), whose buffer is allocated once for all
+ * when the table first appears. Since flushing a child table
+ * (e.g. characters) requires its parents (movies, people) to be written first,
+ * tables are ranked by order of appearance and a flush also outputs every
+ * pending queue of a lower rank.
  *
- * Note: derived classes are hereby non-trivial as they contain a virtual table.
+ * Output rows and bytes are counted per table if statistics are enabled.
  */
 struct DB
 {
 	// Line terminator
 	static constexpr const char* const endl = ";\n";
 
-	// I/O stream to output SQL statements to
-	std::ostream& out;
+	// Buffered output to write SQL statements to
+	writer& out;
+
+	// Maximum number of rows and bytes per INSERT statement
+	std::size_t batch_rows = 1;
+	std::size_t max_statement = 1 << 20;
+
+	// Output statistics, if enabled
+	stats* counters = nullptr;
+
+	// Whether the formatter supports incremental imports
+	static constexpr bool incremental = false;
+
+	DB(writer& w) : out(w) {}
 
-	DB(std::ostream& os) : out(os) {}
+	// Output all pending rows, e.g. at the end of the input stream
+	void flush() { flush(tables.size()); }
 
-	virtual void use(const char* db_name) = 0;
-	virtual std::string list(const std::string&) = 0;
-	virtual void insert(const char* table, const record_view&) = 0;
+	// Output a DELETE statement of the rows of a table by a key value
+	void remove(const char* table, const char* column, std::string_view key);
+
+protected:
+	// Columns of a row in its INSERT statement: the non-empty ones, or all of
+	// them if batched
+	template <typename Table>
+	unsigned columns(const schema::row<Table>& values) const
+	{ return batch_rows < 2 ? schema::present<Table>(values) : schema::all<Table>; }
+
+	// Output or queue an INSERT statement of a row in a given dialect,
+	// followed by a tail (e.g. ON CONFLICT), given the numeric columns
+	template <typename Dialect, typename Table>
+	void insert(const schema::row<Table>&, const char* tail = "", unsigned numbers = 0);
+
+	// Queue a row in the batch of its statement head
+	void write(const char* table, std::string_view head,
+			   std::string_view row, const char* tail);
+
+private:
+	// Pending rows for a given statement head
+	struct batch
+	{
+		std::string_view head;
+		const char* tail;
+		std::size_t rank;
+		std::string rows;
+		std::size_t count;
+	};
+
+	// Output pending batches up to a given table rank (excluded)
+	void flush(std::size_t rank);
+
+	// Scratch buffer to format a queued row
+	writer row_scratch{-1, 4096};
+
+	std::vector<const char*> tables;
+	std::vector<batch> batches;
 };
 
+template <typename Dialect, typename Table>
+void DB::insert(const schema::row<Table>& values, const char* tail, unsigned numbers)
+{
+	const std::string_view head = insert_head<Dialect, Table>(columns<Table>(values));
+
+	// Unbatched mode: one statement per row
+	if (batch_rows < 2)
+	{
+		const std::uint64_t start = out.total();
+		write_values(out << head, values, numbers) << tail << endl;
+		if (counters) counters->add(Table::name, 1, out.total() - start);
+		return;
+	}
+
+	// Queued rows are counted with their separator, statements upon flush
+	row_scratch.clear();
+	write_values(row_scratch, values, numbers, true);
+	if (counters) counters->add(Table::name, 1, row_scratch.view().size() + 1);
+	write(Table::name, head, row_scratch.view(), tail);
+}
+
+void DB::remove(const char* table, const char* column, std::string_view key)
+{
+	const std::uint64_t start = out.total();
+	(out << "DELETE FROM " << table << " WHERE " << column << " = ").quoted(key) << endl;
+	if (counters) counters->add(table, 0, out.total() - start);
+}
+
+void DB::write(const char* table, std::string_view head,
+			   std::string_view row, const char* tail)
+{
+	// Rank the table by order of appearance
+	const auto t = std::find(tables.begin(), tables.end(), table);
+	const std::size_t rank = t - tables.begin();
+	if (t == tables.end()) tables.push_back(table);
+
+	// Find the pending batch of the table, i.e. of its full statement head
+	// (heads are static)
+	auto b = std::find_if(batches.begin(), batches.end(),
+		[&](const batch& b) { return b.head.data() == head.data() && b.tail == tail; });
+	if (b == batches.end())
+	{
+		// Full-size buffer (touched as it fills up): no reallocation later
+		b = batches.insert(batches.end(), { head, tail, rank, {}, 0 });
+		b->rows.reserve(max_statement);
+	}
+
+	// Output this table and its parents if the new row doesn't fit in
+	const std::size_t size = head.size() + b->rows.size() + row.size()
+		+ std::strlen(tail) + std::strlen(endl) + 1;
+	if (b->count && size > max_statement) flush(rank + 1);
+
+	if (b->count++) b->rows += ',';
+	b->rows += row;
+
+	if (b->count >= batch_rows) flush(rank + 1);
+}
+
+void DB::flush(std::size_t rank)
+{
+	for (std::size_t r = 0; r < rank && r < tables.size(); r++)
+		for (auto& b: batches)
+		{
+			if (b.rank != r || b.count == 0) continue;
+			out << b.head << b.rows << b.tail << endl;
+			if (counters)
+				counters->add(tables[r], 0, b.head.size() + std::strlen(b.tail) + std::strlen(endl) - 1);
+			b.rows.clear();
+			b.count = 0;
+		}
+}
+
 /// MySQL database formatter
 struct MySQL : DB
 {
-	MySQL(std::ostream& os) : DB(os) {}
+	static constexpr char verb[] = "INSERT IGNORE ";
+	static constexpr bool incremental = true;
+
+	// Disable foreign key checks for the session (see Shards)
+	static constexpr char unchecked[] = "SET FOREIGN_KEY_CHECKS = 0";
+
+	// Upsert dialect, e.g. "... ON DUPLICATE KEY UPDATE title = VALUES(title)"
+	struct update
+	{
+		static constexpr char verb[] = "INSERT INTO ";
+		static constexpr const char* conflict[] = { " ON DUPLICATE KEY UPDATE ", nullptr };
+		static constexpr const char* inserted[] = { "VALUES(", ")" };
+	};
+
+	MySQL(writer& w) : DB(w) {}
 
 	void use(const char* db_name);
-	std::string list(const std::string&);
-	void insert(const char* table, const record_view&);
+	void list(std::uint32_t set, std::pmr::string& value);
+
+	// The genre set is written as a number
+	template <typename Table>
+	void insert(const schema::row<Table>& values)
+	{
+		constexpr int genre = schema::column<Table>(genre_column);
+		DB::insert<MySQL, Table>(values, "", genre < 0 ? 0 : 1u << genre);
+	}
+
+	template <typename Table>
+	void upsert(const schema::row<Table>& values)
+	{
+		constexpr int genre = schema::column<Table>(genre_column);
+		DB::insert<update, Table>(values,
+			upsert_tail<update, Table>(columns<Table>(values)), genre < 0 ? 0 : 1u << genre);
+	}
 };
 
 void MySQL::use(const char* db_name)
@@ -354,31 +987,44 @@ void MySQL::use(const char* db_name)
 	if (db_name) out << "USE " << db_name << endl;
 }
 
-std::string MySQL::list(const std::string& set)
-{
-	// NOOP: a MySQL set is exactly the list of comma-separated values and
-	// quoted as a string value for insertion
-	return set;
-}
-
-/// Map a record view to an SQL insertion (MySQL)
-void MySQL::insert(const char* table, const record_view& view)
+void MySQL::list(std::uint32_t set, std::pmr::string& value)
 {
-	out << "INSERT IGNORE " << table << '('
-		<< view.names() << ')'
-		<< " VALUES (" << view.values() << ')'
-		<< endl;
+	// A MySQL SET value is the bitmask of its members, or none if empty
+	if (!set) return;
+	char digits[16];
+	value.assign(digits, std::to_chars(digits, digits + sizeof digits, set).ptr);
 }
 
 
 /// PostgreSQL database formatter
 struct PostgreSQL : DB
 {
-	PostgreSQL(std::ostream& os) : DB(os) {}
+	static constexpr char verb[] = "INSERT INTO ";
+	static constexpr bool incremental = true;
+
+	// Disable foreign key checks (triggers) for the session, as a superuser
+	static constexpr char unchecked[] = "SET session_replication_role = replica";
+
+	// Upsert dialect, e.g. "... ON CONFLICT (id) DO UPDATE SET title = EXCLUDED.title"
+	struct update
+	{
+		static constexpr char verb[] = "INSERT INTO ";
+		static constexpr const char* conflict[] = { " ON CONFLICT (", ") DO UPDATE SET " };
+		static constexpr const char* inserted[] = { "EXCLUDED.", "" };
+	};
+
+	PostgreSQL(writer& w) : DB(w) {}
 
 	void use(const char* db_name);
-	std::string list(const std::string&);
-	void insert(const char* table, const record_view&);
+	void list(std::uint32_t set, std::pmr::string& value);
+
+	template <typename Table>
+	void insert(const schema::row<Table>& values)
+	{ DB::insert<PostgreSQL, Table>(values, " ON CONFLICT DO NOTHING"); }
+
+	template <typename Table>
+	void upsert(const schema::row<Table>& values)
+	{ DB::insert<update, Table>(values, upsert_tail<update, Table>(columns<Table>(values))); }
 };
 
 void PostgreSQL::use(const char* db_name)
@@ -386,128 +1032,1975 @@ void PostgreSQL::use(const char* db_name)
 	if (db_name) out << "USE " << db_name << endl;
 }
 
-std::string PostgreSQL::list(const std::string& set)
+void PostgreSQL::list(std::uint32_t set, std::pmr::string& value)
 {
 	// Postgres: Enclose arrays of enums with braces
-	return '{' + set + '}';
+	value += '{';
+	genre_set::join(set, value);
+	value += '}';
 }
 
-/// Map a record view to an SQL insertion (PostgreSQL)
-void PostgreSQL::insert(const char* table, const record_view& view)
+
+/// Absolute path of an existing directory, for scripts run from anywhere
+static std::string absolute_directory(const char* path)
 {
-	out << "INSERT INTO " << table << '('
-		<< view.names() << ')'
-		<< " VALUES (" << view.values() << ") ON CONFLICT DO NOTHING"
-		<< endl;
+	const std::unique_ptr<char, decltype(&std::free)> resolved(::realpath(path, nullptr), &std::free);
+	if (!resolved) throw std::system_error(errno, std::generic_category(), path);
+	return resolved.get();
 }
 
-
-/// Build a string of genres as a comma-separated list of values
-std::string genres(const record::field& f)
+/**
+ * \brief PostgreSQL COPY formatter
+ *
+ * Rows are collected per table and output as "COPY ... FROM STDIN" blocks of
+ * at most \c max_statement bytes into temporary, constraint-free staging
+ * tables, so the blocks of different tables may come in any order. Once the
+ * input is exhausted, flush() merges the staging tables into the target tables
+ * in order of appearance (parents first) and duplicates are skipped with ON
+ * CONFLICT DO NOTHING. The whole output loads with a single psql invocation.
+ *
+ * Staging columns are text (the genre being an array of text) and converted to
+ * the target column types by json_populate_record() on merge.
+ *
+ * Text format escapes backslashes, tabs and line breaks, empty values are NULL
+ * (\N). Binary COPY data can't be inlined in a psql script, hence binary mode
+ * writes one "<table>.pgcopy" file per table in a given directory, which the
+ * script loads with \copy at the end, by absolute path.
+ */
+struct PgCopy : DB
 {
-	// Use a stream iterator to join every value sent to it with a comma
-	std::stringstream buffer;
-	ostream_iterator<std::string_view> out(buffer, ",");
+	PgCopy(writer& w, const char* binary_dir = nullptr) :
+		DB(w), directory(binary_dir ? absolute_directory(binary_dir) : "") {}
 
-	// For each genre sub-record append the text field to the list
-	splitter in(f, record_delimiter);
-	record movie_genre(raw_genre_fields);
-	while (in.begin < in.record.size())
-	{
-		movie_genre.parse(*in++, value_delimiter);
-		*out++ = movie_genre[1];
+	void use(const char* db_name);
+	void list(std::uint32_t set, std::pmr::string& value);
+
+	template <typename Table>
+	void insert(const schema::row<Table>&);
+
+	void flush();
+
+private:
+	// Staging table and pending COPY data
+	struct table
+	{
+		const char* name;
+		std::vector<std::string> columns;
+		std::string data;
+		std::unique_ptr<writer> file;
+	};
+
+	bool binary() const { return !directory.empty(); }
+
+	std::string path(const table& t) const
+	{ return directory + '/' + t.name + ".pgcopy"; }
+
+	// Encode a row into the COPY data of a table, given the index of the
+	// genre column (if any)
+	template <std::size_t N>
+	static void encode_text(std::string&, const std::array<std::string_view, N>&, int genre);
+
+	template <std::size_t N>
+	static void encode_binary(std::string&, const std::array<std::string_view, N>&, int genre);
+
+	// Output the pending data of a table
+	void write_block(table&);
+
+	const std::string directory;
+	std::vector<table> tables;
+};
+
+// Binary COPY signature, flags and header extension length
+static constexpr char pgcopy_header[] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+
+// Text type OID, used for binary arrays
+static constexpr std::uint32_t text_oid = 25;
+
+/// Declare a PostgreSQL staging table of text columns
+static void create_stage(writer& out, const char* table,
+						 const std::vector<std::string>& columns)
+{
+	out << "CREATE TEMP TABLE " << table << "_stage (";
+	for (const auto& c: columns)
+		out << (&c == &columns[0] ? "" : ", ") << c
+			<< (c == genre_column ? " text[]" : " text");
+	out << ')' << DB::endl;
+}
+
+/// Merge a staging table, converting text values to the column types
+static void merge_stage(writer& out, const char* table,
+						const std::vector<std::string>& columns)
+{
+	out << "INSERT INTO " << table << " (";
+	for (const auto& c: columns) out << (&c == &columns[0] ? "" : ", ") << c;
+	out << ") SELECT ";
+	for (const auto& c: columns) out << (&c == &columns[0] ? "r." : ", r.") << c;
+	out << " FROM " << table << "_stage s, json_populate_record(NULL::"
+		<< table << ", row_to_json(s)) r ON CONFLICT DO NOTHING" << DB::endl
+		<< "DROP TABLE " << table << "_stage" << DB::endl;
+}
+
+// Append big-endian integers to binary data
+static void put_int16(std::string& s, std::uint16_t v)
+{ s += char(v >> 8); s += char(v); }
+
+static void put_int32(std::string& s, std::uint32_t v)
+{ put_int16(s, v >> 16); put_int16(s, v); }
+
+// Overwrite a big-endian integer, e.g. a length known once data is appended
+static void set_int32(std::string& s, std::size_t at, std::uint32_t v)
+{
+	for (int i = 3; i >= 0; i--, v >>= 8) s[at + i] = char(v);
+}
+
+void PgCopy::use(const char* db_name)
+{
+	// Connect with the psql meta-command and load in a single transaction
+	if (db_name) out << "\\c " << db_name << '\n';
+	out << "BEGIN" << endl;
+}
+
+void PgCopy::list(std::uint32_t set, std::pmr::string& value)
+{
+	// A comma-separated list: the array is built upon encoding
+	genre_set::join(set, value);
+}
+
+template <typename Table>
+void PgCopy::insert(const schema::row<Table>& values)
+{
+	auto t = std::find_if(tables.begin(), tables.end(),
+		[&](const table& t) { return t.name == Table::name; });
+
+	// Declare the staging table upon the first row
+	if (t == tables.end())
+	{
+		t = tables.insert(tables.end(), {
+			Table::name, { std::begin(Table::columns), std::end(Table::columns) }, {}, nullptr
+		});
+
+		create_stage(out, t->name, t->columns);
+		t->data.reserve(2 * max_statement);	// Blocks overflow by their last row
+
+		if (binary())
+		{
+			t->file = std::make_unique<writer>(path(*t));
+			t->file->timed = counters != nullptr;
+			t->data.assign(pgcopy_header, sizeof(pgcopy_header) - 1);
+		}
+	}
+
+	constexpr int genre = schema::column<Table>(genre_column);
+	const std::size_t start = t->data.size();
+	if (binary()) encode_binary(t->data, values, genre);
+	else encode_text(t->data, values, genre);
+	if (counters) counters->add(Table::name, 1, t->data.size() - start);
+
+	if (t->data.size() >= max_statement) write_block(*t);
+}
+
+template <std::size_t N>
+void PgCopy::encode_text(std::string& data, const std::array<std::string_view, N>& values, int genre)
+{
+	// Escape COPY special characters
+	const auto escape = [&](char c)
+	{
+		switch (c)
+		{
+		case '\\': data += "\\\\"; break;
+		case '\t': data += "\\t"; break;
+		case '\n': data += "\\n"; break;
+		case '\r': data += "\\r"; break;
+		default: data += c;
+		}
+	};
+
+	for (std::size_t i = 0; i < N; i++)
+	{
+		if (i) data += '\t';
+
+		if (int(i) == genre)
+		{
+			// Array literal: quote every element, escaping quotes and
+			// backslashes within, then escape the whole for COPY
+			data += '{';
+			for (splitter it(values[i], list_delimiter); it.begin < it.record.size(); it++)
+			{
+				if (it.begin) data += ',';
+				data += '"';
+				for (char c: *it)
+				{
+					if (c == '"' || c == '\\') escape('\\');
+					escape(c);
+				}
+				data += '"';
+			}
+			data += '}';
+		}
+		else if (values[i].empty()) data += "\\N";
+		else for (char c: values[i]) escape(c);
+	}
+	data += '\n';
+}
+
+template <std::size_t N>
+void PgCopy::encode_binary(std::string& data, const std::array<std::string_view, N>& values, int genre)
+{
+	put_int16(data, N);
+
+	for (std::size_t i = 0; i < N; i++)
+	{
+		if (int(i) == genre)
+		{
+			// One-dimensional array of text, or zero dimension if empty: the
+			// size, dimension and element count are set after the elements
+			const std::size_t start = data.size();
+			put_int32(data, 0);
+			put_int32(data, 1);
+			put_int32(data, 0);
+			put_int32(data, text_oid);
+			put_int32(data, 0);
+			put_int32(data, 1);
+
+			std::uint32_t count = 0;
+			for (splitter it(values[i], list_delimiter); it.begin < it.record.size(); it++)
+			{
+				put_int32(data, (*it).size());
+				data += *it;
+				count++;
+			}
+
+			if (count) set_int32(data, start + 16, count);
+			else
+			{
+				data.resize(start + 16);
+				set_int32(data, start + 4, 0);
+			}
+			set_int32(data, start, data.size() - start - 4);
+		}
+		else if (values[i].empty()) put_int32(data, -1);
+		else
+		{
+			put_int32(data, values[i].size());
+			data += values[i];
+		}
+	}
+}
+
+void PgCopy::write_block(table& t)
+{
+	if (binary()) t.file->write(t.data.data(), t.data.size());
+	else if (!t.data.empty())
+	{
+		const std::uint64_t start = out.total();
+		out << "COPY " << t.name << "_stage FROM STDIN" << endl
+			<< t.data << "\\.\n";
+		if (counters) counters->add(t.name, 0, out.total() - start - t.data.size());
+	}
+	t.data.clear();
+}
+
+void PgCopy::flush()
+{
+	for (auto& t: tables)
+	{
+		if (binary())
+		{
+			// Append the file trailer, then load the whole file
+			put_int16(t.data, -1);
+			write_block(t);
+			t.file->close();
+			if (counters) counters->writes(t.file->write_time);
+
+			out << "\\copy " << t.name << "_stage FROM ";
+			out.quoted(path(t)) << " WITH (FORMAT binary)\n";
+		}
+		else write_block(t);
+	}
+
+	// Merge staging tables in order of appearance
+	for (auto& t: tables) merge_stage(out, t.name, t.columns);
+
+	out << "COMMIT" << endl;
+	tables.clear();
+}
+
+/**
+ * \brief Per-table bulk-load files
+ *
+ * Instead of SQL statements, rows are written as CSV to one file per table,
+ * "<directory>/<table>.csv", headed by the column names of the table. The
+ * "<directory>/load.sql" driver script loads every file in order of appearance
+ * with the bulk loader of the selected database:
+ *
+ * - MySQL: LOAD DATA LOCAL INFILE ... IGNORE (mysql --local-infile=1 client)
+ * - PostgreSQL: \copy ... CSV into staging tables, merged as in PgCopy
+ *
+ * The script names the files by absolute path (the directory is resolved
+ * once, see absolute_directory), hence it may be run from any directory.
+ * Empty values are written unquoted and loaded as NULL.
+ */
+struct BulkFiles : DB
+{
+	enum dialect { mysql, postgres };
+
+	BulkFiles(writer& w, dialect d, const char* dir) :
+		DB(w), type(d), directory(absolute_directory(dir)) {}
+
+	void use(const char* db_name) { name = db_name ? db_name : ""; }
+	void list(std::uint32_t set, std::pmr::string& value);
+
+	template <typename Table>
+	void insert(const schema::row<Table>&);
+
+	void flush();
+
+private:
+	struct table
+	{
+		const char* name;
+		std::vector<std::string> columns;
+		std::unique_ptr<writer> file;
+	};
+
+	std::string path(const std::string& file) const
+	{ return directory + '/' + file; }
+
+	const dialect type;
+	const std::string directory;
+	std::string name;
+	std::vector<table> tables;
+};
+
+void BulkFiles::list(std::uint32_t set, std::pmr::string& value)
+{
+	// A PostgreSQL array as in the INSERT formatter, or a MySQL SET as a list
+	// of names since LOAD DATA reads strings
+	if (type == postgres) value += '{';
+	genre_set::join(set, value);
+	if (type == postgres) value += '}';
+}
+
+template <typename Table>
+void BulkFiles::insert(const schema::row<Table>& values)
+{
+	auto t = std::find_if(tables.begin(), tables.end(),
+		[&](const table& t) { return t.name == Table::name; });
+
+	// Create the table file and its header upon the first row
+	if (t == tables.end())
+	{
+		t = tables.insert(tables.end(), {
+			Table::name, { std::begin(Table::columns), std::end(Table::columns) },
+			std::make_unique<writer>(path(Table::name + std::string(".csv")))
+		});
+		t->file->timed = counters != nullptr;
+
+		for (const auto& c: t->columns)
+			*t->file << (&c == &t->columns[0] ? "" : ",") << c;
+		*t->file << '\n';
+	}
+
+	// Quote non-empty values, doubling quote marks
+	writer& file = *t->file;
+	const std::uint64_t start = file.total();
+	for (const auto& value: values)
+	{
+		if (&value != &values[0]) file << ',';
+		if (!value.empty()) file.quoted(value, '"');
+	}
+	file << '\n';
+	if (counters) counters->add(Table::name, 1, file.total() - start);
+}
+
+void BulkFiles::flush()
+{
+	for (auto& t: tables)
+	{
+		t.file->close();
+		if (counters) counters->writes(t.file->write_time);
+	}
+
+	writer driver(path("load.sql"));
+
+	if (type == mysql)
+	{
+		if (!name.empty()) driver << "USE " << name << endl;
+
+		// Load into user variables to turn empty values into NULL
+		for (const auto& t: tables)
+		{
+			driver << "LOAD DATA LOCAL INFILE ";
+			driver.quoted(path(t.name + std::string(".csv")))
+				<< " IGNORE INTO TABLE " << t.name << " CHARACTER SET utf8mb4"
+				" FIELDS TERMINATED BY ',' OPTIONALLY ENCLOSED BY '\"' ESCAPED BY ''"
+				" LINES TERMINATED BY '\\n' IGNORE 1 LINES (";
+			for (const auto& c: t.columns) driver << (&c == &t.columns[0] ? "@" : ", @") << c;
+			driver << ") SET ";
+			for (const auto& c: t.columns)
+				driver << (&c == &t.columns[0] ? "" : ", ") << c << " = NULLIF(@" << c << ", '')";
+			driver << endl;
+		}
+	}
+	else
+	{
+		if (!name.empty()) driver << "\\c " << name << '\n';
+		driver << "BEGIN" << endl;
+
+		for (const auto& t: tables)
+		{
+			create_stage(driver, t.name, t.columns);
+			driver << "\\copy " << t.name << "_stage FROM ";
+			driver.quoted(path(t.name + std::string(".csv"))) << " WITH (FORMAT csv, HEADER true)\n";
+		}
+		for (const auto& t: tables) merge_stage(driver, t.name, t.columns);
+
+		driver << "COMMIT" << endl;
+	}
+	driver.close();
+
+	tables.clear();
+}
+
+/// Outputs of sharded SQL statements, one per shard
+using shard_outputs = std::vector<std::unique_ptr<writer>>;
+
+/**
+ * \brief Sharded SQL statements
+ *
+ * Rows are partitioned into N SQL scripts, "<directory>/shard-<k>.sql", to be
+ * loaded concurrently by as many client connections (see shards.py). Every
+ * shard has its own formatter of the selected dialect, batched or not, and a
+ * row goes to the shard of the hash of its first column: movies and people by
+ * id, directors and characters by movie id.
+ *
+ * Hence the rows of a given key, and all the links of a movie, always go to
+ * the same shard in input order: two connections never insert the same key,
+ * so they never wait on each other's unique index locks, nor deadlock. Foreign
+ * keys however refer to rows of other shards (e.g. an actor first seen in a
+ * movie of another shard): every script first disables their checks for its
+ * session, and the data is consistent once every shard is loaded.
+ *
+ * Shards are created as regular files unless they exist, e.g. FIFOs (see
+ * mkfifo(1)) read by loaders which are already running.
+ */
+template <typename Formatter>
+struct Shards
+{
+	static constexpr bool incremental = Formatter::incremental;
+
+	// Settings and statistics of every shard (see DB)
+	std::size_t batch_rows = 1;
+	std::size_t max_statement = 1 << 20;
+	stats* counters = nullptr;
+
+	explicit Shards(const shard_outputs& outputs)
+	{ for (const auto& o: outputs) shards.emplace_back(*o); }
+
+	// Output the database name and disable foreign key checks in every shard
+	void use(const char* db_name)
+	{
+		for (auto& s: shards)
+		{
+			s.use(db_name);
+			s.out << Formatter::unchecked << DB::endl;
+		}
+	}
+
+	void list(std::uint32_t set, std::pmr::string& value) { shards.front().list(set, value); }
+
+	template <typename Table>
+	void insert(const schema::row<Table>& values) { route(values[0]).template insert<Table>(values); }
+
+	template <typename Table>
+	void upsert(const schema::row<Table>& values) { route(values[0]).template upsert<Table>(values); }
+
+	// Deletions are by movie id (see delta)
+	void remove(const char* table, const char* column, std::string_view key)
+	{ route(key).remove(table, column, key); }
+
+	void flush() { for (auto& s: shards) s.flush(); }
+
+	// Shard of a key among n
+	static std::size_t shard(std::string_view key, std::size_t n);
+
+private:
+	// Formatter of the shard of a key, with the current settings (set after
+	// construction)
+	Formatter& route(std::string_view key)
+	{
+		Formatter& f = shards[shard(key, shards.size())];
+		f.batch_rows = batch_rows;
+		f.max_statement = max_statement;
+		f.counters = counters;
+		return f;
+	}
+
+	std::deque<Formatter> shards;
+};
+
+template <typename Formatter>
+std::size_t Shards<Formatter>::shard(std::string_view key, std::size_t n)
+{
+	// Numeric ids by value (multiplicative hashing spreads consecutive ids),
+	// others by their bytes
+	std::uint32_t id;
+	const auto [end, error] = std::from_chars(key.data(), key.data() + key.size(), id);
+	const std::uint64_t hash = error == std::errc() && end == key.data() + key.size()
+		? (id * UINT64_C(0x9e3779b97f4a7c15)) >> 32 : std::hash<std::string_view>()(key);
+	return hash % n;
+}
+
+#ifdef SPLIT_SQLITE
+/**
+ * \brief SQLite database writer
+ *
+ * Rows are inserted straight into an SQLite database file, e.g. for local
+ * analyses or tests without a server, with the schema of mysql/CreateCB.sql
+ * (SET and ENUM columns being text). Optional, as it requires libsqlite3:
+ *
+ *	g++ -std=c++17 -O2 -pthread -DSPLIT_SQLITE -o split split.cpp -lsqlite3
+ *	./split --sqlite movies.db < movies.txt
+ *
+ * Every table has a prepared "INSERT OR IGNORE" statement of all columns, to
+ * which the values are bound in place (SQLITE_STATIC), empty ones as NULL:
+ * no SQL text is formatted. Rows are inserted by transactions of up to
+ * \c transaction_rows rows, without rollback journal nor synchronous writes
+ * (a failed load leaves a corrupt file behind). Once the input is exhausted,
+ * the unique indexes of the link tables are created and the default journal
+ * and synchronous modes are restored.
+ *
+ * Without their unique index, link tables don't ignore duplicates: the links
+ * of a movie come from a single line, hence duplicates are filtered per movie
+ * (e.g. an actor playing two characters). Should a movie id appear on several
+ * lines, the remaining duplicates are deleted before indexing.
+ */
+struct SQLite : DB
+{
+	static constexpr std::size_t transaction_rows = 1 << 20;
+
+	SQLite(writer& w, const char* path);
+	~SQLite();
+
+	void use(const char*) {}
+	void list(std::uint32_t set, std::pmr::string& value) { genre_set::join(set, value); }
+
+	template <typename Table>
+	void insert(const schema::row<Table>&);
+
+	void flush();
+
+private:
+	// Execute SQL statements
+	void exec(const char* sql);
+
+	// Throw the last error upon failure
+	void check(int status, const char* what) const;
+
+	// Create the unique index of a link table, deleting duplicates if any
+	void index(const char* table, const char* key, const char* link);
+
+	// Prepared statement of a table, and links of the last movie
+	struct table
+	{
+		const char* name;
+		sqlite3_stmt* insert;
+		std::uint64_t movie;
+		std::vector<std::uint64_t> links;
+	};
+
+	// Parse a numeric id, or return ~0 (views don't outlive streamed lines)
+	static std::uint64_t id(std::string_view);
+
+	sqlite3* db = nullptr;
+	std::vector<table> tables;
+	std::size_t pending = 0;
+};
+
+SQLite::SQLite(writer& w, const char* path) : DB(w)
+{
+	if (!path) throw std::invalid_argument("--sqlite expects a database file");
+
+	const int status = ::sqlite3_open(path, &db);
+	if (status != SQLITE_OK)
+	{
+		const std::string error = db ? ::sqlite3_errmsg(db) : ::sqlite3_errstr(status);
+		::sqlite3_close(db);
+		throw std::runtime_error(std::string(path) + ": " + error);
+	}
+
+	try
+	{
+		exec(
+			"PRAGMA journal_mode = OFF;"
+			"PRAGMA synchronous = OFF;"
+			"PRAGMA locking_mode = EXCLUSIVE;"
+			"PRAGMA cache_size = -262144;"
+			"PRAGMA temp_store = MEMORY;"
+
+			"CREATE TABLE IF NOT EXISTS people ("
+			"  id        INTEGER PRIMARY KEY,"
+			"  full_name VARCHAR(31) NOT NULL CHECK (LENGTH(full_name) > 0)"
+			");"
+			"CREATE TABLE IF NOT EXISTS movies ("
+			"  id             INTEGER PRIMARY KEY,"
+			"  title          VARCHAR(63) NOT NULL CHECK (LENGTH(title) > 0),"
+			"  original_title VARCHAR(63),"
+			"  tag_line       VARCHAR(79),"
+			"  status         TEXT CHECK (status IN ('Released', 'Planned', 'In Production',"
+			"                   'Post Production', 'Canceled', 'Rumored')),"
+			"  genre          TEXT,"
+			"  budget         DECIMAL(10, 2),"
+			"  release_date   DATE,"
+			"  vote_average   DECIMAL(3, 1),"
+			"  vote_count     INTEGER,"
+			"  certification  TEXT CHECK (certification IN ('G', 'PG', 'PG-13', 'R', 'NC-17',"
+			"                   'X', 'NR', 'UR')),"
+			"  runtime        DECIMAL(3),"
+			"  poster_path    TEXT"
+			");"
+			"CREATE TABLE IF NOT EXISTS directors ("
+			"  movie_id    INTEGER NOT NULL REFERENCES movies(id),"
+			"  director_id INTEGER NOT NULL REFERENCES people(id)"
+			");"
+			"CREATE TABLE IF NOT EXISTS characters ("
+			"  movie_id       INTEGER NOT NULL REFERENCES movies(id),"
+			"  actor_id       INTEGER NOT NULL REFERENCES people(id),"
+			"  character_name VARCHAR(31)"
+			");"
+			"BEGIN;");
+	}
+	catch (...)
+	{
+		::sqlite3_close(db);
+		throw;
+	}
+}
+
+SQLite::~SQLite()
+{
+	for (auto& t: tables) ::sqlite3_finalize(t.insert);
+	::sqlite3_close(db);
+}
+
+void SQLite::exec(const char* sql)
+{
+	char* error = nullptr;
+	if (::sqlite3_exec(db, sql, nullptr, nullptr, &error) != SQLITE_OK)
+	{
+		const std::string message(error ? error : "unknown error");
+		::sqlite3_free(error);
+		throw std::runtime_error("sqlite: " + message);
+	}
+}
+
+std::uint64_t SQLite::id(std::string_view s)
+{
+	std::uint64_t id;
+	const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), id);
+	return error == std::errc() && end == s.data() + s.size() ? id : ~std::uint64_t(0);
+}
+
+void SQLite::check(int status, const char* what) const
+{
+	if (status != SQLITE_OK && status != SQLITE_DONE)
+		throw std::runtime_error(std::string("sqlite: ") + what + ": " + ::sqlite3_errmsg(db));
+}
+
+template <typename Table>
+void SQLite::insert(const schema::row<Table>& values)
+{
+	auto t = std::find_if(tables.begin(), tables.end(),
+		[&](const table& t) { return t.name == Table::name; });
+
+	// Prepare the statement of the table upon the first row
+	if (t == tables.end())
+	{
+		std::string sql = "INSERT OR IGNORE INTO " + std::string(Table::name) + '(';
+		for (std::size_t i = 0; i < values.size(); i++)
+			(sql += i ? ", " : "") += Table::columns[i];
+		sql += ") VALUES (?";
+		for (std::size_t i = 1; i < values.size(); i++) sql += ", ?";
+		sql += ')';
+
+		sqlite3_stmt* insert = nullptr;
+		check(::sqlite3_prepare_v3(db, sql.c_str(), sql.size() + 1, SQLITE_PREPARE_PERSISTENT,
+			&insert, nullptr), "prepare");
+		t = tables.insert(tables.end(), { Table::name, insert, ~std::uint64_t(0), {} });
+	}
+
+	// Skip the duplicate links of a movie
+	if constexpr (schema::column<Table>("movie_id") == 0)
+	{
+		const std::uint64_t movie = id(values[0]), link = id(values[1]);
+		if (movie != t->movie)
+		{
+			t->movie = movie;
+			t->links.clear();
+		}
+		if (movie != ~std::uint64_t(0) && link != ~std::uint64_t(0))
+		{
+			if (std::find(t->links.begin(), t->links.end(), link) != t->links.end()) return;
+			t->links.push_back(link);
+		}
+	}
+
+	// Values are valid until the statement is reset
+	std::size_t bytes = 0;
+	for (std::size_t i = 0; i < values.size(); i++)
+	{
+		const std::string_view v = values[i];
+		check(v.empty() ? ::sqlite3_bind_null(t->insert, i + 1)
+			: ::sqlite3_bind_text(t->insert, i + 1, v.data(), v.size(), SQLITE_STATIC), "bind");
+		bytes += v.size();
+	}
+	const int status = ::sqlite3_step(t->insert);
+	::sqlite3_reset(t->insert);
+	check(status, "insert");
+	if (counters) counters->add(Table::name, 1, bytes);
+
+	if (++pending >= transaction_rows)
+	{
+		exec("COMMIT; BEGIN");
+		pending = 0;
+	}
+}
+
+void SQLite::flush()
+{
+	exec("COMMIT");
+	pending = 0;
+
+	// Unique indexes are cheaper to build at once than to maintain row by row
+	index(schema::directors::name, schema::directors::columns[0], schema::directors::columns[1]);
+	index(schema::characters::name, schema::characters::columns[0], schema::characters::columns[1]);
+
+	exec(
+		"PRAGMA journal_mode = DELETE;"
+		"PRAGMA synchronous = FULL;"
+		"PRAGMA locking_mode = NORMAL;");
+}
+
+void SQLite::index(const char* table, const char* key, const char* link)
+{
+	const std::string t(table), columns = std::string(key) + ", " + link;
+	const std::string create = "CREATE UNIQUE INDEX IF NOT EXISTS " + t + "_" + key
+		+ " ON " + t + "(" + columns + ")";
+
+	if (::sqlite3_exec(db, create.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK) return;
+	if (::sqlite3_errcode(db) != SQLITE_CONSTRAINT) check(SQLITE_ERROR, "index");
+
+	exec(("DELETE FROM " + t + " WHERE rowid NOT IN (SELECT MIN(rowid) FROM " + t
+		+ " GROUP BY " + columns + ")").c_str());
+	exec(create.c_str());
+}
+#endif /* ifdef SPLIT_SQLITE */
+
+/**
+ * \brief Columnar snapshot writer
+ *
+ * Instead of SQL statements, rows are collected into the columns of a
+ * snapshot file (see snapshot.h), written once the input is exhausted, which
+ * downstream jobs map rather than parsing movies.txt again:
+ *
+ * - movies.id, vote_count, runtime, genre (set value, see genre_set) and
+ *   release_date (YYYYMMDD) as u32, status and certification as u8 (index
+ *   of the ENUM value in mysql/CreateCB.sql), vote_average as f32 and budget
+ *   as f64, in input order
+ * - movies.title, original_title, tag_line and poster_path as strings
+ * - movies.directors and movies.cast, the person ids of every movie, along
+ *   with cast.character_name, the name of every cast entry
+ * - people.id (u32, sorted) and people.full_name, one row per person
+ *
+ * Ids which aren't numbers are null (people without a numeric id are left
+ * out). The whole snapshot is held in memory until written.
+ */
+struct Snapshot : DB
+{
+	Snapshot(writer& w, const char* _path) : DB(w), path(_path)
+	{ if (!path) throw std::invalid_argument("--snapshot expects a snapshot file"); }
+
+	void use(const char*) {}
+	void list(std::uint32_t set, std::pmr::string& value);
+
+	template <typename Table>
+	void insert(const schema::row<Table>& values)
+	{
+		add(Table{}, values);
+		if (counters)
+		{
+			std::size_t bytes = 0;
+			for (const auto& v: values) bytes += v.size();
+			counters->add(Table::name, 1, bytes);
+		}
+	}
+
+	void flush();
+
+private:
+	void add(schema::movies, const schema::row<schema::movies>&);
+	void add(schema::people, const schema::row<schema::people>&);
+	void add(schema::directors, const schema::row<schema::directors>&);
+	void add(schema::characters, const schema::row<schema::characters>&);
+
+	// Parse a number, or return null (all ones, or NaN)
+	template <typename T>
+	static T number(std::string_view);
+
+	// Parse a YYYY-MM-DD date, return the number YYYYMMDD or null
+	static std::uint32_t date(std::string_view);
+
+	// Return the index of an ENUM value, or null
+	template <std::size_t N>
+	static std::uint8_t index(const std::string_view (&values)[N], std::string_view);
+
+	const char* const path;
+
+	// Movie columns
+	std::vector<std::uint32_t> id, vote_count, runtime, genre, release_date;
+	std::vector<std::uint8_t> status, certification;
+	std::vector<float> vote_average;
+	std::vector<double> budget;
+	snapshot_builder::strings title, original_title, tag_line, poster_path;
+	snapshot_builder::adjacency directors, cast;
+	snapshot_builder::strings character_name;
+
+	// People, in order of appearance
+	hashset people{1 << 16};
+	std::vector<std::uint32_t> person_id;
+	snapshot_builder::strings full_name;
+};
+
+void Snapshot::list(std::uint32_t set, std::pmr::string& value)
+{
+	// The set value, parsed back into the genre column
+	char digits[16];
+	value.assign(digits, std::to_chars(digits, digits + sizeof digits, set).ptr);
+}
+
+template <typename T>
+T Snapshot::number(std::string_view s)
+{
+	T n;
+	const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), n);
+	if (error == std::errc() && end == s.data() + s.size()) return n;
+	if constexpr (std::is_floating_point_v<T>) return std::numeric_limits<T>::quiet_NaN();
+	else return ~T(0);
+}
+
+std::uint32_t Snapshot::date(std::string_view s)
+{
+	if (s.size() != 10 || s[4] != '-' || s[7] != '-') return ~0u;
+	const std::uint32_t y = number<std::uint32_t>(s.substr(0, 4)),
+		m = number<std::uint32_t>(s.substr(5, 2)), d = number<std::uint32_t>(s.substr(8, 2));
+	return y > 9999 || m > 12 || d > 31 ? ~0u : (y * 100 + m) * 100 + d;
+}
+
+template <std::size_t N>
+std::uint8_t Snapshot::index(const std::string_view (&values)[N], std::string_view s)
+{
+	const auto i = std::find(std::begin(values), std::end(values), s);
+	return i == std::end(values) ? 0xff : i - std::begin(values);
+}
+
+void Snapshot::add(schema::movies, const schema::row<schema::movies>& values)
+{
+	using schema::column;
+	typedef schema::movies movies;
+
+	// End the links of the previous movie
+	if (!id.empty())
+	{
+		directors.next();
+		cast.next();
+	}
+
+	id.push_back(number<std::uint32_t>(values[column<movies>("id")]));
+	vote_count.push_back(number<std::uint32_t>(values[column<movies>("vote_count")]));
+	runtime.push_back(number<std::uint32_t>(values[column<movies>("runtime")]));
+	genre.push_back(values[column<movies>("genre")].empty() ? 0
+		: number<std::uint32_t>(values[column<movies>("genre")]));
+	release_date.push_back(date(values[column<movies>("release_date")]));
+	status.push_back(index(schema::statuses, values[column<movies>("status")]));
+	certification.push_back(index(schema::certifications, values[column<movies>("certification")]));
+	vote_average.push_back(number<float>(values[column<movies>("vote_average")]));
+	budget.push_back(number<double>(values[column<movies>("budget")]));
+	title.push(values[column<movies>("title")]);
+	original_title.push(values[column<movies>("original_title")]);
+	tag_line.push(values[column<movies>("tag_line")]);
+	poster_path.push(values[column<movies>("poster_path")]);
+}
+
+void Snapshot::add(schema::people, const schema::row<schema::people>& values)
+{
+	const std::uint32_t person = number<std::uint32_t>(values[0]);
+	if (person == ~0u || !people.insert(person)) return;
+	person_id.push_back(person);
+	full_name.push(values[1]);
+}
+
+void Snapshot::add(schema::directors, const schema::row<schema::directors>& values)
+{
+	// Links belong to the last movie
+	directors.ids.push_back(number<std::uint32_t>(values[1]));
+}
+
+void Snapshot::add(schema::characters, const schema::row<schema::characters>& values)
+{
+	cast.ids.push_back(number<std::uint32_t>(values[1]));
+	character_name.push(values[2]);
+}
+
+void Snapshot::flush()
+{
+	if (!id.empty())
+	{
+		directors.next();
+		cast.next();
+	}
+
+	// Sort people by id
+	std::vector<std::uint32_t> order(person_id.size());
+	for (std::uint32_t i = 0; i < order.size(); i++) order[i] = i;
+	std::sort(order.begin(), order.end(),
+		[&](std::uint32_t a, std::uint32_t b) { return person_id[a] < person_id[b]; });
+
+	std::vector<std::uint32_t> sorted_id;
+	snapshot_builder::strings sorted_name;
+	sorted_id.reserve(order.size());
+	sorted_name.data.reserve(full_name.data.size());
+	for (const std::uint32_t i: order)
+	{
+		sorted_id.push_back(person_id[i]);
+		sorted_name.push({ full_name.data.data() + full_name.offsets[i],
+			full_name.offsets[i + 1] - full_name.offsets[i] });
+	}
+
+	// Substring search indexes
+	const trigram_builder title_grams(title), original_title_grams(original_title),
+		full_name_grams(sorted_name);
+
+	snapshot_builder s;
+	s.column("movies.id", id);
+	s.column("movies.title", title);
+	s.column("movies.original_title", original_title);
+	s.column("movies.release_date", release_date);
+	s.column("movies.status", status);
+	s.column("movies.vote_average", vote_average);
+	s.column("movies.vote_count", vote_count);
+	s.column("movies.runtime", runtime);
+	s.column("movies.certification", certification);
+	s.column("movies.poster_path", poster_path);
+	s.column("movies.budget", budget);
+	s.column("movies.tag_line", tag_line);
+	s.column("movies.genre", genre);
+	s.column("movies.directors", directors);
+	s.column("movies.cast", cast);
+	s.column("cast.character_name", character_name);
+	s.column("people.id", sorted_id);
+	s.column("people.full_name", sorted_name);
+	s.column("movies.title.grams", title_grams.grams);
+	s.column("movies.title.postings", title_grams.postings);
+	s.column("movies.original_title.grams", original_title_grams.grams);
+	s.column("movies.original_title.postings", original_title_grams.postings);
+	s.column("people.full_name.grams", full_name_grams.grams);
+	s.column("people.full_name.postings", full_name_grams.postings);
+	s.save(path);
+}
+
+/// Build the set of genres of a movie, counting unknown genres
+std::uint32_t genres(const structure& index, const record::field& f, std::size_t& unknown)
+{
+	std::uint32_t set = 0;
+
+	// For each genre sub-record add the member of the text field
+	indexed_splitter in(index, f, structure::record_level);
+	record movie_genre(raw_genre_fields);
+	while (in.begin < in.record.size())
+	{
+		movie_genre.parse(index, *in++, structure::value_level);
+		const int member = genre_set::find(movie_genre[1].value);
+		if (member >= 0) set |= 1u << member;
+		else unknown++;
+	}
+
+	return set;
+}
+
+/**
+ * \brief Cross-record duplicate filter
+ *
+ * Popular people appear in thousands of movies, each appearance producing the
+ * same "people" row, which the database server would skip on its own (INSERT
+ * IGNORE, ON CONFLICT). This filter remembers the person ids and (movie id,
+ * actor id) pairs already written to suppress repeated "people" and
+ * "characters" rows, and counts the rows saved. Non-numeric ids always pass.
+ */
+struct dedup
+{
+	hashset people{1 << 20}, characters{1 << 20};
+	std::size_t people_saved = 0, characters_saved = 0;
+
+	// Return whether a person or a character hasn't been output yet
+	bool person(std::string_view id);
+	bool character(std::string_view movie_id, std::string_view actor_id);
+
+	// Parse a numeric id (32-bit unsigned as per the database schema)
+	static bool parse(std::string_view, std::uint32_t&);
+};
+
+bool dedup::parse(std::string_view s, std::uint32_t& id)
+{
+	const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), id);
+	return error == std::errc() && end == s.data() + s.size();
+}
+
+bool dedup::person(std::string_view s)
+{
+	std::uint32_t id;
+	if (!parse(s, id) || people.insert(id)) return true;
+	people_saved++;
+	return false;
+}
+
+bool dedup::character(std::string_view movie, std::string_view actor)
+{
+	std::uint32_t movie_id, actor_id;
+	if (!parse(movie, movie_id) || !parse(actor, actor_id)
+		|| characters.insert(std::uint64_t(movie_id) << 32 | actor_id)) return true;
+	characters_saved++;
+	return false;
+}
+
+/**
+ * \brief Incremental import
+ *
+ * Compares the movie lines with the fingerprint index of the previous import
+ * (see fingerprint_index), by movie id. An unchanged line is skipped on its
+ * hash alone, before it is split. A changed movie is upserted and, if their
+ * list changed, its directors or characters rows are deleted and inserted
+ * again. A new movie is inserted. Movies missing from the input are deleted
+ * with their directors and characters rows once the input is exhausted, but
+ * people rows are kept since they are shared. Lines without a numeric id are
+ * always imported.
+ *
+ * The new index is only saved once the statements are output. It describes
+ * the database as of this import, hence must be discarded if loading fails.
+ */
+struct delta
+{
+	typedef fingerprint_index::entry entry;
+
+	const char* const path;
+	const fingerprint_index previous;
+
+	// Whether the movies of the previous index are in the input
+	std::vector<bool> seen;
+
+	// Entries of the input movies, i.e. the next index
+	std::vector<entry> current;
+
+	std::size_t unchanged = 0, changed = 0, added = 0, removed = 0;
+
+	explicit delta(const char* _path) : path(_path), previous(_path), seen(previous.size())
+	{ current.reserve(previous.size()); }
+
+	// Parse the id of a movie line, i.e. its first field
+	static bool id(std::string_view line, std::uint32_t&);
+
+	// Return the previous entry of a movie, if any, marking it as seen
+	const entry* find(std::uint32_t id);
+
+	// Output the deletion of the movies not seen
+	template <typename Database>
+	void finish(Database&);
+
+	void save() { fingerprint_index::save(path, current); }
+};
+
+bool delta::id(std::string_view line, std::uint32_t& id)
+{
+	const std::size_t end = line.find(movie_delimiter);
+	return dedup::parse(line.substr(0, end), id);
+}
+
+const delta::entry* delta::find(std::uint32_t id)
+{
+	const entry* e = previous.find(id);
+	if (e) seen[e - previous.begin()] = true;
+	return e;
+}
+
+template <typename Database>
+void delta::finish(Database& db)
+{
+	// Children first
+	for (const entry& e: previous)
+	{
+		if (seen[&e - previous.begin()]) continue;
+
+		char digits[16];
+		const std::string_view id(digits, std::to_chars(digits, digits + sizeof digits, e.id).ptr - digits);
+		db.remove(schema::characters::name, schema::characters::columns[0], id);
+		db.remove(schema::directors::name, schema::directors::columns[0], id);
+		db.remove(schema::movies::name, schema::movies::columns[0], id);
+		removed++;
 	}
+}
 
-	std::string set;
-	buffer >> quote(set);
+/**
+ * \brief Movie id filter
+ *
+ * Selects movie lines by their id, i.e. their first field, before any other
+ * parsing: lines are found with memchr(3) as usual (see line_reader), and
+ * the line of an unselected movie is skipped as soon as its id is parsed.
+ *
+ * Listed ids are looked up in a bitmap, or in a sorted array if too sparse
+ * (e.g. a few huge ids), and ranges are compared in turn.
+ */
+class id_filter
+{
+public:
+	// Add the ids of a comma-separated list, or of a file (one id per line,
+	// or separated with commas or blanks)
+	void ids(const char* list);
 
-	return set;
+	// Add a range of ids "A-B" (bounds included)
+	void range(const char* range);
+
+	// Whether a line (or a movie id) is selected
+	bool operator () (std::string_view line) const
+	{
+		std::uint32_t id;
+		return delta::id(line, id) && (*this)(id);
+	}
+
+	bool operator () (std::uint32_t id) const
+	{
+		if (id < bitmap.size() * 64 && (bitmap[id / 64] >> id % 64 & 1)) return true;
+		if (std::binary_search(sorted.begin(), sorted.end(), id)) return true;
+		for (const auto& r: ranges)
+			if (id >= r.first && id <= r.second) return true;
+		return false;
+	}
+
+private:
+	// Add ids of a text, then index them
+	void parse(std::string_view text, const char* source);
+
+	std::vector<std::uint64_t> bitmap;
+	std::vector<std::uint32_t> sorted;
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges;
+};
+
+void id_filter::ids(const char* list)
+{
+	// A list is made of digits and commas, anything else names a file
+	const std::string_view text(list);
+	if (!text.empty() && text.find_first_not_of("0123456789,") == text.npos)
+	{
+		parse(text, "--ids");
+		return;
+	}
+
+	line_reader file(list);
+	for (std::string_view line; file.next(line);) parse(line, list);
 }
 
-int main(int argc, char **argv)
+void id_filter::parse(std::string_view text, const char* source)
 {
-	try
+	std::vector<std::uint32_t> ids(sorted);
+	for (std::size_t at = 0; (at = text.find_first_not_of(", \t\r", at)) != text.npos;)
+	{
+		const std::size_t end = std::min(text.find_first_of(", \t\r", at), text.size());
+		std::uint32_t id;
+		if (!dedup::parse(text.substr(at, end - at), id))
+			throw std::invalid_argument(std::string(source) + ": invalid movie id "
+				+ std::string(text.substr(at, end - at)));
+		ids.push_back(id);
+		at = end;
+	}
+
+	// Merge the ids already indexed
+	for (std::size_t i = 0; i < bitmap.size() * 64; i++)
+		if (bitmap[i / 64] >> i % 64 & 1) ids.push_back(i);
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	bitmap.clear();
+	sorted.clear();
+	if (ids.empty()) return;
+	// A bitmap unless it would take over 32 times the space of the array
+	if (ids.back() / 64 <= ids.size() * 16)
+	{
+		bitmap.assign(ids.back() / 64 + 1, 0);
+		for (const std::uint32_t id: ids) bitmap[id / 64] |= std::uint64_t(1) << id % 64;
+	}
+	else sorted.swap(ids);
+}
+
+void id_filter::range(const char* range)
+{
+	const std::string_view text(range);
+	const std::size_t dash = text.find('-');
+	std::uint32_t first, last;
+	if (dash == text.npos || !dedup::parse(text.substr(0, dash), first)
+		|| !dedup::parse(text.substr(dash + 1), last) || first > last)
+		throw std::invalid_argument("--id-range expects A-B, A <= B, got " + std::string(text));
+	ranges.emplace_back(first, last);
+}
+
+/**
+ * \brief Movie line importer
+ *
+ * Splits a movie line and inserts its records. The movie record and the
+ * structural index are reused from one line to another, hence one importer
+ * per thread. The duplicate filter, the incremental import state, schema
+ * validation and the id filter are optional (null). The importer is a template over the database formatter
+ * type, whose insertions are inlined.
+ *
+ * Transient strings (e.g. the genre list) are allocated from a per-line arena
+ * which is reset upon the next line, and records have an inline field array:
+ * once buffers have grown to the size of the largest line, importing a line
+ * makes no heap allocation.
+ */
+template <typename Database>
+struct importer
+{
+	Database& db;
+	dedup* const seen;
+
+	record movie{raw_movie_fields};
+	structure index;
+
+	// Per-line arena, backed by the heap past its initial buffer
+	char arena_buffer[1 << 14];
+	std::pmr::monotonic_buffer_resource arena{arena_buffer, sizeof arena_buffer};
+
+	// Number of genres skipped, not being members of the genre set
+	std::size_t unknown_genres = 0;
+
+	// Statistics, if enabled, and the end of the previous line
+	stats* const counters;
+	stats::clock::time_point mark = stats::clock::now();
+
+	// Incremental import state, if enabled (SQL formatters only)
+	delta* const changes;
+
+	// Schema validation, if enabled
+	validation* const checks;
+
+	// Selected movies, if not all
+	const id_filter* const filter;
+
+	importer(Database& _db, dedup* _seen = nullptr, stats* _counters = nullptr,
+			 delta* _changes = nullptr, validation* _checks = nullptr, const id_filter* _filter = nullptr) :
+		db(_db), seen(_seen), counters(_counters), changes(_changes), checks(_checks), filter(_filter)
+	{ db.counters = counters; }
+
+	void operator () (std::string_view line);
+
+private:
+	// Upsert a changed movie
+	void update(const schema::row<schema::movies>& values)
+	{ if constexpr (Database::incremental) db.template upsert<schema::movies>(values); }
+
+	// Check every row of the parsed line (see schema::accept)
+	bool accepted();
+
+	// Fix the values of an accepted row, if so requested
+	template <typename Table>
+	void fix(schema::row<Table>& values)
+	{ if (checks && checks->fix) schema::fix<Table>(values, *checks); }
+
+	// Count an input line, ending the stage of a given lap
+	void count(std::string_view line, stats::stage s, stats::clock::time_point lap)
+	{
+		mark = counters->lap(s, lap);
+		counters->lines++;
+		counters->bytes += line.size() + 1;
+		counters->line_length.add(line.size());
+	}
+};
+
+template <typename Database>
+bool importer<Database>::accepted()
+{
+	schema::row<schema::movies> values;
+	for (std::size_t i = 0; i < values.size(); i++) values[i] = movie[i].value;
+	bool accepted = schema::accept<schema::movies>(values, *checks);
+
+	record director(raw_director_fields);
+	for (indexed_splitter it(index, movie[-2], structure::record_level); it.begin < it.record.size();)
+	{
+		director.parse(index, *it++, structure::value_level);
+		accepted &= schema::accept<schema::people>({ director[0].value, director[1].value }, *checks);
+	}
+
+	record actor(raw_actor_fields);
+	for (indexed_splitter it(index, movie[-1], structure::record_level); it.begin < it.record.size();)
+	{
+		actor.parse(index, *it++, structure::value_level);
+		accepted &= schema::accept<schema::people>({ actor[0].value, actor[1].value }, *checks);
+		accepted &= schema::accept<schema::characters>({
+			movie[0].value, actor[0].value, actor[2].value
+		}, *checks);
+	}
+	return accepted;
+}
+
+template <typename Database>
+void importer<Database>::operator () (std::string_view line)
+{
+	// The time since the previous line was spent reading this one
+	stats::clock::time_point lap;
+	if (counters) lap = counters->lap(stats::read, mark);
+
+	// Skip unselected movies, which an incremental import keeps as they were
+	std::uint32_t id;
+	const bool numbered = filter && delta::id(line, id);
+	if (filter && !(numbered && (*filter)(id)))
+	{
+		const delta::entry* previous;
+		if (numbered && changes && (previous = changes->find(id))) changes->current.push_back(*previous);
+		if (counters) count(line, stats::split, lap);
+		return;
+	}
+
+	// Incremental import: skip an unchanged line on its hash
+	delta::entry entry{};
+	const delta::entry* previous = nullptr;
+	const bool tracked = changes && delta::id(line, entry.id);
+	if (tracked)
+	{
+		entry.line = fingerprint(line);
+		previous = changes->find(entry.id);
+		if (previous && previous->line == entry.line)
+		{
+			changes->current.push_back(*previous);
+			changes->unchanged++;
+			if (counters) count(line, stats::split, lap);
+			return;
+		}
+	}
+
+	// Free the transient strings of the previous line
+	arena.release();
+
+	// Index all delimiters, then split raw record into raw fields
+	index.build(line);
+	movie.parse(index, line, structure::movie_level);
+	if (counters) lap = counters->lap(stats::split, lap);
+
+	// Reject the whole line if any of its rows would fail, keeping the
+	// previous version of the movie, if any
+	if (checks && !accepted())
+	{
+		checks->lines_rejected++;
+		if (checks->rejects) *checks->rejects << line << '\n';
+		if (previous) changes->current.push_back(*previous);
+		if (counters) count(line, stats::split, lap);
+		return;
+	}
+
+	if (tracked)
+	{
+		entry.directors = fingerprint(movie[-2].value);
+		entry.cast = fingerprint(movie[-1].value);
+		changes->current.push_back(entry);
+		(previous ? changes->changed : changes->added)++;
+	}
+
+	// Split and replace the genre field
+	std::pmr::string tmp(&arena);
+	db.list(genres(index, movie[-3], unknown_genres), tmp);
+	movie[-3].value = tmp;
+	if (counters) lap = counters->lap(stats::genre, lap);
+
+	// 1. insert the constructed movie record
+	// Reuse all fields but the last 2 (directors & cast)
+	schema::row<schema::movies> values;
+	for (std::size_t i = 0; i < values.size(); i++) values[i] = movie[i].value;
+	fix<schema::movies>(values);
+	if (previous) update(values);
+	else db.template insert<schema::movies>(values);
+
+	// 2. Build the director record(s), unless unchanged since the previous
+	// import (otherwise replace them)
+	if (!previous || previous->directors != entry.directors)
+	{
+		if (previous) db.remove(schema::directors::name, schema::directors::columns[0], movie[0].value);
+
+		record director(raw_director_fields);
+		for (indexed_splitter it(index, movie[-2], structure::record_level); it.begin < it.record.size();)
+		{
+			director.parse(index, *it++, structure::value_level);
+
+			// Insert into people
+			if (!seen || seen->person(director[0].value))
+			{
+				schema::row<schema::people> person{ director[0].value, director[1].value };
+				fix<schema::people>(person);
+				db.template insert<schema::people>(person);
+			}
+
+			// Then insert into directors
+			db.template insert<schema::directors>({ movie[0].value, director[0].value });
+		}
+	}
+
+	// 3. Build the actor records, likewise
+	const bool actors = !previous || previous->cast != entry.cast;
+	std::size_t cast = 0;
+	if (actors)
+	{
+		if (previous) db.remove(schema::characters::name, schema::characters::columns[0], movie[0].value);
+
+		record actor(raw_actor_fields);
+		for (indexed_splitter it(index, movie[-1], structure::record_level); it.begin < it.record.size(); cast++)
+		{
+			actor.parse(index, *it++, structure::value_level);
+
+			// Insert into people...
+			if (!seen || seen->person(actor[0].value))
+			{
+				schema::row<schema::people> person{ actor[0].value, actor[1].value };
+				fix<schema::people>(person);
+				db.template insert<schema::people>(person);
+			}
+
+			// ... then characters
+			if (!seen || seen->character(movie[0].value, actor[0].value))
+			{
+				schema::row<schema::characters> character{ movie[0].value, actor[0].value, actor[2].value };
+				fix<schema::characters>(character);
+				db.template insert<schema::characters>(character);
+			}
+		}
+	}
+
+	// Formatting includes the write(2) calls, until moved (see stats::writes)
+	if (counters)
 	{
-		// Select between MySQL & PostgreSQL
-		if (argc < 2 || argc > 3) throw std::system_error(EINVAL, std::generic_category());
+		count(line, stats::format, lap);
+		if (actors) counters->cast_size.add(cast);
+	}
+}
+
+/**
+ * \brief Command line settings
+ *
+ * The database type option comes first, followed by optional settings and the
+ * database name, e.g. "--mysql --batch 1000 movies".
+ */
+struct options
+{
+	const char* type = nullptr;
+	const char* db_name = nullptr;
+
+	// Batched INSERT settings (see DB)
+	std::size_t batch_rows = 1;
+	std::size_t max_statement = 1 << 20;
+
+	// Binary COPY data directory (PostgreSQL COPY only)
+	const char* binary_dir = nullptr;
+
+	// Bulk-load file directory (MySQL & PostgreSQL)
+	const char* bulk_dir = nullptr;
+
+	// Number of shards of SQL statements (0: none) and their directory
+	std::size_t shards = 0;
+	const char* output_dir = nullptr;
+
+	// Suppress repeated people and characters rows
+	bool dedup = false;
+
+	// Input file, memory-mapped if regular (default: stdin)
+	const char* input = nullptr;
+
+	// Number of worker threads (0: serial import) and chunk size
+	std::size_t threads = 0;
+	std::size_t chunk_size = 1 << 20;
+
+	// Fingerprint index of the previous import, for an incremental import
+	const char* state = nullptr;
+
+	// Print statistics upon completion, and progress every so many seconds
+	bool stats = false;
+	std::size_t stats_every = 0;
+
+	// Output to a pipe with vmsplice(2) rather than write(2), if the consumer
+	// doesn't splice it further (e.g. "pv"), which would leave it pages which
+	// are then reused (see writer::splice)
+	bool splice = false;
+
+	// Selected movie ids, if any
+	std::optional<id_filter> filter;
+
+	// Schema validation: fix invalid values, and/or output rejected lines
+	bool validate = false;
+	const char* reject = nullptr;
+
+	options(int argc, char** argv);
+
+	// Convert a numeric option argument
+	static std::size_t number(const char* option, const char* value);
+};
+
+options::options(int argc, char** argv)
+{
+	if (argc < 2) throw std::system_error(EINVAL, std::generic_category());
+	type = argv[1];
+
+	for (int i = 2; i < argc; i++)
+	{
+		const std::string option(argv[i]);
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (option == "--batch") batch_rows = number(argv[i++], value);
+		else if (option == "--max-statement") max_statement = number(argv[i++], value);
+		else if (option == "--binary" && value) binary_dir = argv[++i];
+		else if (option == "--bulk" && value) bulk_dir = argv[++i];
+		else if (option == "--shards") shards = number(argv[i++], value);
+		else if (option == "--output-dir" && value) output_dir = argv[++i];
+		else if (option == "--dedup") dedup = true;
+		else if (option == "--input" && value) input = argv[++i];
+		else if (option == "-j") threads = number(argv[i++], value);
+		else if (option == "--chunk") chunk_size = number(argv[i++], value);
+		else if (option == "--state" && value) state = argv[++i];
+		else if (option == "--stats") stats = true;
+		else if (option == "--validate") validate = true;
+		else if (option == "--splice") splice = true;
+		else if ((option == "--ids" || option == "--id-range") && value)
+		{
+			if (!filter) filter.emplace();
+			if (option == "--ids") filter->ids(argv[++i]);
+			else filter->range(argv[++i]);
+		}
+		else if (option == "--reject" && value) reject = argv[++i];
+		else if (option == "--stats-every")
+		{
+			stats_every = number(argv[i++], value);
+			stats = true;
+		}
+		else if (option[0] != '-' && !db_name) db_name = argv[i];
+		else throw std::invalid_argument("unexpected argument " + option);
+	}
+
+	// Parallel import requires self-contained chunk outputs
+	const std::string kind(type);
+	const bool statements = !bulk_dir && kind != "--copy" && kind != "--sqlite" && kind != "--snapshot";
+	if (!shards != !output_dir || (shards && (!statements || (kind != "--mysql" && kind != "--postgres"))))
+		throw std::invalid_argument("--shards and --output-dir go together, with --mysql or --postgres");
+
+	if (threads && (!statements || dedup))
+		throw std::invalid_argument("-j only supports INSERT statements without --dedup");
+
+	// Incremental import requires updates and deletions in input order
+	if (state && (threads || !statements))
+		throw std::invalid_argument("--state only supports serial INSERT statements");
+}
+
+std::size_t options::number(const char* option, const char* value)
+{
+	char* end = nullptr;
+	const unsigned long long n = value ? std::strtoull(value, &end, 10) : 0;
+	if (!value || *end || n == 0)
+		throw std::invalid_argument(std::string(option) + " expects a positive number");
+	return n;
+}
+
+/**
+ * \brief Database formatter selection
+ *
+ * Build the database formatter from the command line settings and call a
+ * given function with it. Formatters are distinct types (see DB), hence the
+ * function is generic, e.g. a lambda with an auto parameter.
+ */
+template <typename Function>
+void with_db(const options& opts, writer& out, Function&& f, const shard_outputs* shards = nullptr)
+{
+	const auto run = [&](auto&& db)
+	{
+		db.batch_rows = opts.batch_rows;
+		db.max_statement = opts.max_statement;
+		f(db);
+	};
+
+	// Select between MySQL, PostgreSQL (possibly sharded), PostgreSQL COPY,
+	// bulk-load files, snapshots & SQLite, whose database name is the file name
+	const std::string type(opts.type);
+	if (shards)
+	{
+		if (type == "--mysql") return run(Shards<MySQL>(*shards));
+		if (type == "--postgres") return run(Shards<PostgreSQL>(*shards));
+	}
+	else if (opts.bulk_dir)
+	{
+		if (type == "--mysql") return run(BulkFiles(out, BulkFiles::mysql, opts.bulk_dir));
+		if (type == "--postgres") return run(BulkFiles(out, BulkFiles::postgres, opts.bulk_dir));
+	}
+	else if (type == "--mysql") return run(MySQL(out));
+	else if (type == "--postgres") return run(PostgreSQL(out));
+	else if (type == "--copy") return run(PgCopy(out, opts.binary_dir));
+	else if (type == "--snapshot") return run(Snapshot(out, opts.db_name));
+	else if (type == "--sqlite")
+	{
+#ifdef SPLIT_SQLITE
+		return run(SQLite(out, opts.db_name));
+#else
+		throw std::runtime_error("SQLite output is not available (build with -DSPLIT_SQLITE -lsqlite3).");
+#endif
+	}
+
+	throw std::runtime_error("database type is unspecified.");
+}
+
+/**
+ * \brief Parallel import
+ *
+ * The input is cut into chunks of whole lines, which a pool of worker threads
+ * split and format into per-chunk output buffers, each chunk with its own
+ * database formatter. The main thread reads chunks ahead (up to a window of
+ * 4 chunks per thread) and writes the buffers out in input order.
+ *
+ * Workers pick the oldest pending chunk from a shared queue whenever they are
+ * idle, rather than being assigned a static share of the input, so a chunk of
+ * lines with huge casts only holds up one worker.
+ *
+ * Chunk boundaries only depend on the input and the chunk size, and batches
+ * are flushed at the end of every chunk: the output is the same whatever the
+ * number of threads and, unbatched, the same as a serial import.
+ *
+ * Sharded statements are formatted into per-chunk buffers of every shard and
+ * appended to the shard outputs, also in input order.
+ *
+ * Statistics of every chunk are merged into the totals, if enabled, as the
+ * chunk is written out: stage times are then summed over all threads. So are
+ * validation counters, and rejected lines are written out in input order.
+ *
+ * Return the number of unknown genres skipped.
+ */
+std::size_t import_parallel(line_reader& input, const options& opts, writer& out, stats* totals = nullptr,
+							validation* checks = nullptr, shard_outputs* shards = nullptr)
+{
+	struct chunk
+	{
+		std::string storage;
+		std::string_view lines;
+		writer output;
+		shard_outputs shards;
+		std::size_t unknown_genres = 0;
+		stats counters;
+		validation checks;
+		writer rejected{-1, 1 << 12};
+		std::exception_ptr error;
+		bool done = false;
+	};
 
-		std::unique_ptr<DB> db;
-		if (std::string(argv[1]) == "--mysql") db = std::make_unique<MySQL>(std::cout);
-		if (std::string(argv[1]) == "--postgres") db = std::make_unique<PostgreSQL>(std::cout);
+	std::mutex mutex;
+	std::condition_variable pending_cv, done_cv;
+	std::deque<std::unique_ptr<chunk>> window;	// In input order
+	std::deque<chunk*> pending;					// Not yet picked up
+	bool finished = false;
+	std::size_t unknown_genres = 0;
+
+	const auto work = [&]()
+	{
+		for (;;)
+		{
+			chunk* c;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				pending_cv.wait(lock, [&]() { return finished || !pending.empty(); });
+				if (pending.empty()) return;
+				c = pending.front();
+				pending.pop_front();
+			}
 
-		if (!db) throw std::runtime_error("database type is unspecified.");
+			try
+			{
+				if (checks)
+				{
+					c->checks.fix = checks->fix;
+					c->checks.rejects = checks->rejects ? &c->rejected : nullptr;
+				}
+
+				if (shards)
+					for (std::size_t k = 0; k < shards->size(); k++)
+						c->shards.push_back(std::make_unique<writer>(-1, 1 << 16));
+
+				with_db(opts, c->output, [&](auto& db)
+				{
+					importer<std::decay_t<decltype(db)>> import(db, nullptr, totals ? &c->counters : nullptr,
+						nullptr, checks ? &c->checks : nullptr, opts.filter ? &*opts.filter : nullptr);
+					line_reader lines(c->lines);
+					std::string_view line;
+					while (lines.next(line)) import(line);
+					db.flush();
+					c->unknown_genres = import.unknown_genres;
+				}, shards ? &c->shards : nullptr);
+			}
+			catch (...) { c->error = std::current_exception(); }
 
-		// Get and output the database name if any
-		const char* db_name = argc == 3 ? argv[2] : nullptr;
-		db->use(db_name);
+			std::lock_guard<std::mutex> lock(mutex);
+			c->done = true;
+			done_cv.notify_all();
+		}
+	};
 
-		// Parse each line from the input stream
-		std::string line;
-		record movie(raw_movie_fields);
-		while (std::getline(std::cin, line))
+	// Write out the oldest chunk once done
+	const auto write_front = [&]()
+	{
+		std::unique_ptr<chunk> c;
 		{
-			// Split raw record into raw fields
-			movie.parse(line, movie_delimiter);
+			std::unique_lock<std::mutex> lock(mutex);
+			done_cv.wait(lock, [&]() { return window.front()->done; });
+			c = std::move(window.front());
+			window.pop_front();
+		}
+		if (c->error) std::rethrow_exception(c->error);
 
-			// Split and replace the genre field (unquoting prevously quoted values)
-			std::string tmp = db->list(genres(movie[-3]));
-			movie[-3].value = tmp;
+		const stats::clock::time_point start = stats::clock::now();
+		out << c->output.view();
+		for (std::size_t k = 0; k < c->shards.size(); k++) *(*shards)[k] << c->shards[k]->view();
+		unknown_genres += c->unknown_genres;
+		if (checks)
+		{
+			checks->merge(c->checks);
+			if (checks->rejects) *checks->rejects << c->rejected.view();
+		}
+		if (totals)
+		{
+			totals->merge(c->counters);
+			totals->lap(stats::write, start);
+		}
+	};
 
-			// 1. insert the constructed movie record
-			// Reuse all fields but the last 2 (directors & cast)
-			db->insert("movies", record_view(movie, 0, -2));
+	// Progress report, if requested
+	const stats::clock::time_point started = stats::clock::now();
+	stats::clock::time_point next_report = started + std::chrono::seconds(opts.stats_every);
+	const auto report = [&]()
+	{
+		const stats::clock::time_point now = stats::clock::now();
+		if (!totals || !opts.stats_every || now < next_report) return;
+		totals->progress(std::cerr, std::chrono::duration<double>(now - started).count());
+		next_report = now + std::chrono::seconds(opts.stats_every);
+	};
 
-			// This is also valid:
-			// mysql_insert("movies", {movie, 0, -2});
+	std::vector<std::thread> workers;
+	for (std::size_t i = 0; i < opts.threads; i++) workers.emplace_back(work);
 
-			// 2. Build the director record(s)
-			record director(raw_director_fields);
-			for (splitter it(movie[-2], record_delimiter); it.begin < it.record.size();)
+	try
+	{
+		for (;;)
+		{
+			if (window.size() >= 4 * opts.threads)
 			{
-				director.parse(*it++, value_delimiter);
-
-				// Insert into people (the record instance is converted into a
-				// record_view by the latter's constructor)
-				db->insert("people", record({
-					{ "id", director[0].value },
-					{ "full_name", director[1].value },
-				}));
-
-				// Then insert into directors
-				db->insert("directors", record({
-					{ "movie_id", movie[0].value },
-					{ "director_id", director[0].value },
-				}));
+				write_front();
+				report();
 			}
 
-			// 3. Build the actor records
-			record actor(raw_actor_fields);
-			for (splitter it(movie[-1], record_delimiter); it.begin < it.record.size();)
+			auto c = std::make_unique<chunk>();
+			const stats::clock::time_point start = stats::clock::now();
+			if (!input.next_chunk(opts.chunk_size, c->storage, c->lines)) break;
+			if (totals) totals->lap(stats::read, start);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.push_back(c.get());
+			window.push_back(std::move(c));
+			pending_cv.notify_one();
+		}
+
+		while (!window.empty())
+		{
+			write_front();
+			report();
+		}
+	}
+	catch (...)
+	{
+		// Let the workers finish before unwinding the chunks
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.clear();
+			finished = true;
+		}
+		pending_cv.notify_all();
+		for (auto& w: workers) w.join();
+		throw;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+	}
+	pending_cv.notify_all();
+	for (auto& w: workers) w.join();
+	return unknown_genres;
+}
+
+// The benchmarks (bench.cpp) include this file without its entry point
+#ifndef SPLIT_NO_MAIN
+int main(int argc, char **argv)
+{
+	try
+	{
+		const options opts(argc, argv);
+
+		writer out(STDOUT_FILENO);
+
+		// Hand the output pages to the SQL client if piped and requested (see writer::splice)
+		if (opts.splice) out.splice();
+
+		// Shard scripts, if sharded (see Shards)
+		shard_outputs shards;
+		for (std::size_t k = 0; k < opts.shards; k++)
+		{
+			shards.push_back(std::make_unique<writer>(
+				std::string(opts.output_dir) + "/shard-" + std::to_string(k) + ".sql"));
+			if (opts.splice) shards.back()->splice();
+		}
+		int status = EXIT_SUCCESS;
+		std::size_t unknown_genres = 0;
+
+		// Duplicate filter, if requested
+		std::optional<dedup> seen;
+		if (opts.dedup) seen.emplace();
+
+		// Previous fingerprint index, if an incremental import
+		std::optional<delta> changes;
+		if (opts.state) changes.emplace(opts.state);
+
+		// Schema validation, if requested
+		std::optional<writer> rejects;
+		std::optional<validation> checks;
+		if (opts.reject) rejects.emplace(std::string(opts.reject));
+		if (opts.validate || opts.reject)
+		{
+			checks.emplace();
+			checks->fix = opts.validate;
+			checks->rejects = rejects ? &*rejects : nullptr;
+		}
+
+		// Statistics, if requested: the write calls of a serial import are
+		// timed apart from formatting (see stats::writes)
+		std::optional<stats> totals;
+		const stats::clock::time_point started = stats::clock::now();
+		const auto elapsed = [&]()
+		{ return std::chrono::duration<double>(stats::clock::now() - started).count(); };
+		if (opts.stats)
+		{
+			totals.emplace();
+			out.timed = !opts.threads;
+			for (auto& s: shards) s->timed = !opts.threads;
+		}
+
+		with_db(opts, out, [&](auto& db)
+		{
+			// Output the database name if any
+			db.use(opts.db_name);
+
+			// Parse each line from the input file or stream
+			line_reader input(opts.input);
+			if (opts.threads)
+				unknown_genres = import_parallel(input, opts, out, totals ? &*totals : nullptr,
+					checks ? &*checks : nullptr, opts.shards ? &shards : nullptr);
+			else
 			{
-				actor.parse(*it++, value_delimiter);
-
-				// Insert into people...
-				db->insert("people", record({
-					{ "id", actor[0].value },
-					{ "full_name", actor[1].value },
-				}));
-
-				// ... then characters
-				db->insert("characters", record({
-					{ "movie_id", movie[0].value },
-					{ "actor_id", actor[0].value },
-					{ "character_name", actor[2].value },
-				}));
+				importer<std::decay_t<decltype(db)>> import(db, seen ? &*seen : nullptr,
+					totals ? &*totals : nullptr, changes ? &*changes : nullptr, checks ? &*checks : nullptr,
+					opts.filter ? &*opts.filter : nullptr);
+				std::string_view line;
+#ifdef SPLIT_COUNT_ALLOCATIONS
+				// Lines which allocate, unless longer than any before them
+				std::size_t lines = 0, longest = 0, allocating = 0;
+				while (input.next(line))
+				{
+					const std::size_t before = allocations;
+					import(line);
+					if (++lines > 1000 && line.size() <= longest && allocations != before) allocating++;
+					longest = std::max(longest, line.size());
+				}
+				std::cerr << argv[0] << " : " << allocating << " of " << lines
+					<< " lines allocated memory after warm-up\n";
+				if (allocating) status = EXIT_FAILURE;
+#else
+				if (opts.stats_every)
+				{
+					// Check the time every so many lines only
+					std::uint64_t next_report = opts.stats_every;
+					while (input.next(line))
+					{
+						import(line);
+						if (totals->lines % 1024 == 0 && elapsed() >= next_report)
+						{
+							totals->progress(std::cerr, elapsed());
+							next_report += opts.stats_every;
+						}
+					}
+				}
+				else while (input.next(line)) import(line);
+#endif
+				unknown_genres = import.unknown_genres;
 			}
+
+			// Output the last batches, then delete the movies not found
+			const stats::clock::time_point start = stats::clock::now();
+			db.flush();
+			if (changes) changes->finish(db);
+			out.flush();
+			for (auto& s: shards) s->close();
+			if (totals) totals->lap(opts.threads ? stats::write : stats::format, start);
+		}, opts.shards ? &shards : nullptr);
+
+		// The new state matches the complete output only
+		if (changes)
+		{
+			changes->save();
+			std::cerr << argv[0] << " : movies unchanged: " << changes->unchanged
+				<< ", changed: " << changes->changed << ", new: " << changes->added
+				<< ", removed: " << changes->removed << '\n';
 		}
 
-		return EXIT_SUCCESS;
+		if (rejects) rejects->close();
+		if (checks)
+		{
+			std::cerr << argv[0] << " : ";
+			checks->print(std::cerr);
+		}
+
+		if (totals)
+		{
+			totals->writes(out.write_time);
+			for (const auto& s: shards) totals->writes(s->write_time);
+			std::cerr << argv[0] << " : ";
+			totals->print(std::cerr, elapsed());
+		}
+
+		if (seen) std::cerr
+			<< argv[0] << " : duplicates suppressed: "
+			<< seen->people_saved << " people rows ("
+			<< seen->people.size() << " distinct), "
+			<< seen->characters_saved << " characters rows\n";
+
+		if (unknown_genres) std::cerr
+			<< argv[0] << " : unknown genres skipped: " << unknown_genres << '\n';
+
+		return status;
 	}
 	catch (const std::exception& e)
 	{
 		std::cerr
 			<< argv[0] << " : " << e.what()
-			<< "\n\nSyntax: " << argv[0] << " --mysql|--postgres [DATABASE]\n";
+			<< "\n\nSyntax: " << argv[0] << " --mysql|--postgres|--copy|--sqlite|--snapshot"
+			" [--batch ROWS] [--max-statement BYTES] [--binary DIR] [--bulk DIR]"
+			" [--shards N --output-dir DIR]"
+			" [--dedup] [--input FILE] [-j THREADS [--chunk BYTES]]"
+			" [--ids FILE|LIST] [--id-range A-B] [--state FILE] [--validate] [--reject FILE] [--splice]"
+			" [--stats [--stats-every SECONDS]]"
+			" [DATABASE]\n";
 		return EXIT_FAILURE;
 	}
 }
+#endif /* ifndef SPLIT_NO_MAIN */
@@ -55,6 +55,13 @@ Dans le premier exemple, seul le film dont l'identifiant, 11 (premier champ,
 en début de ligne) est importé. Dans le second, ce sont les films 11, 497 et
 12317.
 
+Le programme split.cpp sélectionne lui-même les films par leur identifiant,
+sans expression régulière ni processus supplémentaire (liste, fichier
+d'identifiants ou intervalle):
+
+	split --mysql --ids 11,497,12317 < movies.txt | mysql -u root
+	split --mysql --id-range 1000-2000 < movies.txt | mysql -u root
+
 Le client SQL peut aussi se trouver sur une autre machine, en réseau:
 
 	split.py ... | ssh <adresse> "mysql -u root"
@@ -74,12 +81,21 @@ Les doublons sont ignorés:
 
 Le choix de la syntaxe est confié aux classes fournies par le module db.py en
 fonction du type de base de données passé en argument à la ligne de commande.
+
+Si l'extension _split est compilée (voir splitmodule.c), les lignes sont
+découpées par la bibliothèque de split.cpp, par blocs, et les films sont
+transmis au script sous forme de tuples, champs déjà séparés.
 """
 
 import sys
 from collections import namedtuple
 from db import Postgres, MySQL
 
+try:
+	import _split
+except ImportError:
+	_split = None
+
 # Database record definitions
 MovieActor = namedtuple('movie_actor', ['movie_id', 'actor_id', 'character_name'])
 MovieDirector = namedtuple('movie_director', ['movie_id', 'director_id'])
@@ -106,6 +122,19 @@ def split(text):
 	except AttributeError:
 		return tuple()
 
+def native_movies(stream, block_size=1 << 20):
+	""" Parse a binary stream by blocks with the _split extension and yield
+	every movie as (fields, genres, directors, cast). """
+	pending = b''
+	while True:
+		block = stream.read(block_size)
+		data = pending + block if pending else block
+		movies, parsed = _split.parse(data, final=not block)
+		yield from movies
+		pending = data[parsed:]
+		if not block:
+			break
+
 
 # List of constructors for each possible long option
 systems = { '--mysql': MySQL, '--postgres': Postgres }
@@ -118,6 +147,20 @@ except:
 	print('Syntax:', sys.argv[0], '--mysql|--postgres [DATABASE]', file=sys.stderr)
 	sys.exit(1)
 
+if _split:
+	for fields, genres, directors, cast in native_movies(sys.stdin.buffer):
+		movie = Movie._make(fields + (db.list(genres) if genres else '',))
+		db.insert('movies', movie)
+
+		for actor_id, name, character in cast:
+			db.insert('people', Person(actor_id, name))
+			db.insert('characters', MovieActor(movie.id, actor_id, character))
+
+		for director_id, name in directors:
+			db.insert('people', Person(director_id, name))
+			db.insert('directors', MovieDirector(movie.id, director_id))
+	sys.exit(0)
+
 for line in sys.stdin:
 	# Remove trailing spaces from each line in the source stream
 	raw_movie = line.strip().split(TRIANGLE_BULLET)
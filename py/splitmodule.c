@@ -0,0 +1,333 @@
+/**
+ * splitmodule.c
+ *
+ * DESCRIPTION
+ *
+ * The _split Python extension: movie lines parsed and SQL statements
+ * formatted by libsplit.so (see libsplit.h), for split.py and db.py.
+ *
+ *	g++ -std=c++17 -O2 -pthread -fPIC -shared -fvisibility=hidden \
+ *		-Wl,--version-script=libsplit.map -o libsplit.so libsplit.cpp
+ *	gcc -O2 -fPIC -shared $(python3-config --includes) -o _split$(python3-config --extension-suffix) \
+ *		splitmodule.c -L. -lsplit -Wl,-rpath,'$ORIGIN'
+ *
+ * _split.parse(data, final=False) parses the complete lines of a block of
+ * bytes and returns a list of movies along with the number of bytes parsed,
+ * the remainder being the beginning of the next line (or the last line if
+ * final). A movie is a tuple of tuples of strings, no field being split in
+ * Python: (fields, genres, directors, cast), i.e. the movie columns but the
+ * genre, the genre names, then (id, name) per director and (id, name,
+ * character) per actor. Lines are stripped as by str.strip(), blank ones
+ * being skipped.
+ *
+ * _split.Formatter("mysql" or "postgres") formats the INSERT statement of a
+ * row, insert(table, values), and the genre value of genre names, genres(),
+ * in the syntax of split.cpp.
+ *
+ * LICENSING
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+
+#include "libsplit.h"
+
+// Maximum number of values of a row
+#define MAX_VALUES 16
+
+// Line parser, used with the GIL held
+static split_parser* parser;
+
+// Python string of a byte string
+static PyObject* string(split_string s)
+{ return PyUnicode_DecodeUTF8(s.data, (Py_ssize_t)s.size, "replace"); }
+
+// Tuple of count records of width strings each, or of strings if width is 0
+static PyObject* records(const split_string* s, size_t count, size_t width)
+{
+	PyObject* tuple = PyTuple_New((Py_ssize_t)count);
+	for (size_t i = 0; tuple && i < count; i++)
+	{
+		PyObject* item = width ? records(s + i * width, width, 0) : string(s[i]);
+		if (!item)
+		{
+			Py_DECREF(tuple);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(tuple, i, item);
+	}
+	return tuple;
+}
+
+static PyObject* movie_tuple(const split_movie* m)
+{
+	return Py_BuildValue("(NNNN)",
+		records(m->fields, SPLIT_MOVIE_FIELDS - 1, 0),
+		records(m->genres, m->genre_count, 0),
+		records(m->directors, m->director_count, 2),
+		records(m->cast, m->cast_count, 3));
+}
+
+// UTF-8 whitespace characters beyond ASCII, as of str.isspace()
+static const char* const spaces[] = {
+	"\xc2\x85", "\xc2\xa0", "\xe1\x9a\x80", "\xe2\x80\x80", "\xe2\x80\x81", "\xe2\x80\x82",
+	"\xe2\x80\x83", "\xe2\x80\x84", "\xe2\x80\x85", "\xe2\x80\x86", "\xe2\x80\x87",
+	"\xe2\x80\x88", "\xe2\x80\x89", "\xe2\x80\x8a", "\xe2\x80\xa8", "\xe2\x80\xa9",
+	"\xe2\x80\xaf", "\xe2\x81\x9f", "\xe3\x80\x80"
+};
+
+// Size of the whitespace character at the start (or the end) of a string, if
+// any, hence lines are stripped as by str.strip() in split.py
+static size_t space(const char* s, size_t n, int end)
+{
+	if (!n) return 0;
+	const unsigned char c = end ? s[n - 1] : s[0];
+	if ((c >= '\t' && c <= '\r') || (c >= 0x1c && c <= ' ')) return 1;
+	if (c < 0x80) return 0;
+
+	for (size_t i = 0; i < sizeof spaces / sizeof *spaces; i++)
+	{
+		const size_t k = strlen(spaces[i]);
+		if (k <= n && !memcmp(end ? s + n - k : s, spaces[i], k)) return k;
+	}
+	return 0;
+}
+
+static PyObject* parse(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+	static char* keywords[] = { "data", "final", NULL };
+	Py_buffer buffer;
+	int final = 0;
+	(void)self;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|p:parse", keywords, &buffer, &final)) return NULL;
+
+	PyObject* movies = PyList_New(0);
+	const char* data = buffer.buf;
+	const size_t size = (size_t)buffer.len;
+	size_t at = 0;
+	while (movies && at < size)
+	{
+		// Complete lines only, but the last one of the input
+		const char* lf = memchr(data + at, '\n', size - at);
+		if (!lf && !final) break;
+		const size_t end = lf ? (size_t)(lf - data) : size;
+
+		const char* line = data + at;
+		size_t length = end - at, k;
+		while ((k = space(line, length, 0))) line += k, length -= k;
+		while ((k = space(line, length, 1))) length -= k;
+		if (length)
+		{
+			split_movie m;
+			PyObject* movie = NULL;
+			if (split_parse(parser, line, length, &m) < 0)
+				PyErr_SetString(PyExc_ValueError, split_parser_error(parser));
+			else movie = movie_tuple(&m);
+
+			if (!movie || PyList_Append(movies, movie) < 0) Py_CLEAR(movies);
+			Py_XDECREF(movie);
+		}
+		at = lf ? end + 1 : size;
+	}
+
+	PyBuffer_Release(&buffer);
+	return movies ? Py_BuildValue("(Nn)", movies, (Py_ssize_t)at) : NULL;
+}
+
+/**
+ * \brief Formatter object
+ */
+typedef struct
+{
+	PyObject_HEAD
+	split_formatter* formatter;
+} Formatter;
+
+static int formatter_init(Formatter* self, PyObject* args, PyObject* kwargs)
+{
+	static char* keywords[] = { "dialect", NULL };
+	const char* dialect;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s:Formatter", keywords, &dialect)) return -1;
+
+	split_dialect d;
+	if (!strcmp(dialect, "mysql")) d = SPLIT_MYSQL;
+	else if (!strcmp(dialect, "postgres")) d = SPLIT_POSTGRES;
+	else
+	{
+		PyErr_Format(PyExc_ValueError, "unknown dialect %s", dialect);
+		return -1;
+	}
+
+	split_formatter_free(self->formatter);
+	if (!(self->formatter = split_formatter_new(d)))
+	{
+		PyErr_NoMemory();
+		return -1;
+	}
+	return 0;
+}
+
+// Whether the formatter was initialized, or raise RuntimeError
+static int formatter_ready(const Formatter* self)
+{
+	if (self->formatter) return 1;
+	PyErr_SetString(PyExc_RuntimeError, "Formatter.__init__() was not called");
+	return 0;
+}
+
+static void formatter_dealloc(Formatter* self)
+{
+	split_formatter_free(self->formatter);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// Genre value of an iterable of genre names, unknown ones being skipped
+static PyObject* formatter_genres(Formatter* self, PyObject* names)
+{
+	if (!formatter_ready(self)) return NULL;
+	PyObject* iterator = PyObject_GetIter(names);
+	if (!iterator) return NULL;
+
+	uint32_t set = 0;
+	PyObject* name;
+	while ((name = PyIter_Next(iterator)))
+	{
+		const char* s = PyUnicode_Check(name) ? PyUnicode_AsUTF8(name) : NULL;
+		for (unsigned i = 0; s && split_genre(i); i++)
+			if (!strcmp(s, split_genre(i))) set |= UINT32_C(1) << i;
+		Py_DECREF(name);
+		if (!s) break;
+	}
+	Py_DECREF(iterator);
+	if (PyErr_Occurred()) return NULL;
+	if (name)
+	{
+		PyErr_SetString(PyExc_TypeError, "genre names must be strings");
+		return NULL;
+	}
+
+	split_string value;
+	if (split_format_genres(self->formatter, set, &value) < 0)
+	{
+		PyErr_SetString(PyExc_RuntimeError, split_formatter_error(self->formatter));
+		return NULL;
+	}
+	return string(value);
+}
+
+// INSERT statement of a row: a table name and a sequence of strings (or None)
+static PyObject* formatter_insert(Formatter* self, PyObject* args)
+{
+	const char* name;
+	PyObject* row;
+	if (!formatter_ready(self) || !PyArg_ParseTuple(args, "sO:insert", &name, &row)) return NULL;
+
+	int table = -1;
+	for (int t = SPLIT_MOVIES; t <= SPLIT_CHARACTERS; t++)
+		if (!strcmp(name, split_table_name((split_table)t))) table = t;
+	if (table < 0) return PyErr_Format(PyExc_ValueError, "unknown table %s", name);
+
+	PyObject* sequence = PySequence_Fast(row, "values must be a sequence");
+	if (!sequence) return NULL;
+
+	split_string values[MAX_VALUES];
+	const Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+	for (Py_ssize_t i = 0; i < count && i < MAX_VALUES; i++)
+	{
+		PyObject* value = PySequence_Fast_GET_ITEM(sequence, i);
+		Py_ssize_t size = 0;
+		values[i].data = value == Py_None ? "" : PyUnicode_Check(value) ? PyUnicode_AsUTF8AndSize(value, &size) : NULL;
+		values[i].size = (size_t)size;
+		if (!values[i].data)
+		{
+			Py_DECREF(sequence);
+			if (!PyErr_Occurred()) PyErr_SetString(PyExc_TypeError, "values must be strings or None");
+			return NULL;
+		}
+	}
+
+	// Values are valid while the sequence holds them
+	split_string statement;
+	const int status = split_format_insert(self->formatter, (split_table)table, values,
+		count < MAX_VALUES ? (size_t)count : MAX_VALUES + 1, &statement);
+	Py_DECREF(sequence);
+	if (status < 0)
+	{
+		PyErr_SetString(PyExc_ValueError, split_formatter_error(self->formatter));
+		return NULL;
+	}
+	return string(statement);
+}
+
+static PyMethodDef formatter_methods[] = {
+	{ "genres", (PyCFunction)formatter_genres, METH_O, "Genre value of genre names" },
+	{ "insert", (PyCFunction)formatter_insert, METH_VARARGS, "INSERT statement of a row" },
+	{ NULL }
+};
+
+static PyTypeObject FormatterType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "_split.Formatter",
+	.tp_doc = "SQL statement formatter of a dialect, \"mysql\" or \"postgres\"",
+	.tp_basicsize = sizeof(Formatter),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)formatter_init,
+	.tp_dealloc = (destructor)formatter_dealloc,
+	.tp_methods = formatter_methods,
+};
+
+static PyMethodDef methods[] = {
+	{ "parse", (PyCFunction)(void(*)(void))parse, METH_VARARGS | METH_KEYWORDS,
+		"parse(data, final=False) -> (movies, parsed bytes)" },
+	{ NULL }
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "_split",
+	.m_doc = "Native movie line parser and SQL formatter",
+	.m_size = -1,
+	.m_methods = methods,
+};
+
+PyMODINIT_FUNC PyInit__split(void)
+{
+	// A library of another major version is incompatible
+	if (split_version() >> 16 != SPLIT_VERSION >> 16)
+		return PyErr_Format(PyExc_ImportError, "libsplit version %u.%u, expected %u.x",
+			split_version() >> 16, split_version() & 0xffff, SPLIT_VERSION >> 16);
+
+	if (PyType_Ready(&FormatterType) < 0) return NULL;
+	if (!parser && !(parser = split_parser_new())) return PyErr_NoMemory();
+
+	PyObject* m = PyModule_Create(&module);
+	if (!m) return NULL;
+	Py_INCREF(&FormatterType);
+	if (PyModule_AddObject(m, "Formatter", (PyObject*)&FormatterType) < 0)
+	{
+		Py_DECREF(&FormatterType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	return m;
+}
@@ -0,0 +1,206 @@
+/*
+ * state.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __STATE_H__
+#define __STATE_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "output.h"
+
+/**
+ * \brief 64-bit content hash
+ *
+ * Reads 16 bytes per step, folded with a 64x64 to 128-bit multiplication (as
+ * in wyhash): several GB/s, hence hashing a line costs much less than
+ * splitting it. Meant for change detection, not as a cryptographic digest.
+ */
+inline std::uint64_t fingerprint(std::string_view s)
+{
+	constexpr std::uint64_t k0 = 0xa0761d6478bd642fULL, k1 = 0xe7037ed1a0b428dbULL;
+
+	const auto mum = [](std::uint64_t a, std::uint64_t b)
+	{
+		const unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+		return static_cast<std::uint64_t>(r) ^ static_cast<std::uint64_t>(r >> 64);
+	};
+
+	std::uint64_t w[2], h = k0;
+	const char* p = s.data();
+	std::size_t n = s.size();
+	for (; n >= sizeof w; p += sizeof w, n -= sizeof w)
+	{
+		std::memcpy(w, p, sizeof w);
+		h = mum(w[0] ^ k1, w[1] ^ h);
+	}
+
+	// Zero-padded tail, then the length
+	w[0] = w[1] = 0;
+	std::memcpy(w, p, n);
+	h = mum(w[0] ^ k1, w[1] ^ h);
+	return mum(h ^ k0, s.size() ^ k1);
+}
+
+/**
+ * \brief Movie fingerprint index
+ *
+ * Maps movie ids to the hashes of their input line and of its directors and
+ * cast lists (see fingerprint), as of a previous import.
+ *
+ * The file is a header ("RQSTATE1" and the number of entries) followed by
+ * fixed-size entries sorted by id, in host byte order. It is memory-mapped
+ * and used in place: opening it reads nothing but the header, and a lookup is
+ * a binary search touching a few pages. A missing file is an empty index,
+ * e.g. upon the first import.
+ */
+class fingerprint_index
+{
+public:
+	struct entry
+	{
+		std::uint32_t id;
+		std::uint32_t reserved;
+		std::uint64_t line, directors, cast;
+	};
+
+	// Map an index file, if any
+	explicit fingerprint_index(const char* path);
+	~fingerprint_index();
+
+	fingerprint_index(const fingerprint_index&) = delete;
+	fingerprint_index& operator = (const fingerprint_index&) = delete;
+
+	// Return the entry of a movie id, or null
+	const entry* find(std::uint32_t id) const;
+
+	const entry* begin() const { return entries; }
+	const entry* end() const { return entries + count; }
+	std::size_t size() const { return count; }
+
+	// Sort entries by id, keeping the first of duplicate ids, and write them
+	// to a temporary file which then replaces the index file
+	static void save(const char* path, std::vector<entry>& entries);
+
+private:
+	struct header
+	{
+		char magic[8];
+		std::uint64_t count;
+	};
+
+	static constexpr char magic[] = "RQSTATE1";
+
+	void* map = nullptr;
+	std::size_t map_size = 0;
+
+	const entry* entries = nullptr;
+	std::size_t count = 0;
+};
+
+inline fingerprint_index::fingerprint_index(const char* path)
+{
+	const int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		if (errno == ENOENT) return;
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		map_size = st.st_size;
+		map = ::mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	const int error = errno;
+	::close(fd);
+	if (map == MAP_FAILED)
+	{
+		map = nullptr;
+		throw std::system_error(error, std::generic_category(), path);
+	}
+
+	// The header tells the number of entries, which must fill the file
+	const header* h = static_cast<const header*>(map);
+	if (map_size < sizeof(header) || std::memcmp(h->magic, magic, sizeof h->magic)
+		|| (map_size - sizeof(header)) / sizeof(entry) != h->count
+		|| (map_size - sizeof(header)) % sizeof(entry))
+	{
+		::munmap(map, map_size);
+		map = nullptr;
+		throw std::runtime_error(std::string(path) + ": not a fingerprint index");
+	}
+
+	entries = reinterpret_cast<const entry*>(h + 1);
+	count = h->count;
+}
+
+inline fingerprint_index::~fingerprint_index()
+{
+	if (map) ::munmap(map, map_size);
+}
+
+inline const fingerprint_index::entry* fingerprint_index::find(std::uint32_t id) const
+{
+	const entry* e = std::lower_bound(begin(), end(), id,
+		[](const entry& e, std::uint32_t id) { return e.id < id; });
+	return e != end() && e->id == id ? e : nullptr;
+}
+
+inline void fingerprint_index::save(const char* path, std::vector<entry>& entries)
+{
+	const auto less = [](const entry& a, const entry& b) { return a.id < b.id; };
+	if (!std::is_sorted(entries.begin(), entries.end(), less))
+		std::stable_sort(entries.begin(), entries.end(), less);
+	entries.erase(std::unique(entries.begin(), entries.end(),
+		[](const entry& a, const entry& b) { return a.id == b.id; }), entries.end());
+
+	header h{};
+	std::memcpy(h.magic, magic, sizeof h.magic);
+	h.count = entries.size();
+
+	// Replace the index at once, e.g. while it is mapped
+	const std::string temporary = std::string(path) + ".tmp";
+	{
+		writer file(temporary);
+		file.write(reinterpret_cast<const char*>(&h), sizeof h);
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(entry));
+		file.close();
+	}
+	if (::rename(temporary.c_str(), path) < 0)
+		throw std::system_error(errno, std::generic_category(), path);
+}
+
+
+#endif /* if __STATE_H__ */
@@ -0,0 +1,207 @@
+/*
+ * stats.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <array>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+
+/**
+ * \brief Power-of-two histogram
+ *
+ * Counts values into buckets [2^(i-1), 2^i), bucket 0 holding zeros, along
+ * with the number of values, their sum and maximum.
+ */
+class histogram
+{
+public:
+	void add(std::uint64_t v)
+	{
+		buckets[v ? 64 - __builtin_clzll(v) : 0]++;
+		count++;
+		sum += v;
+		if (v > max) max = v;
+	}
+
+	void merge(const histogram&);
+
+	// Print the mean, maximum and non-empty buckets
+	void print(std::ostream&, const char* title) const;
+
+private:
+	std::array<std::uint64_t, 65> buckets{};
+	std::uint64_t count = 0, sum = 0, max = 0;
+};
+
+inline void histogram::merge(const histogram& h)
+{
+	for (std::size_t i = 0; i < buckets.size(); i++) buckets[i] += h.buckets[i];
+	count += h.count;
+	sum += h.sum;
+	if (h.max > max) max = h.max;
+}
+
+inline void histogram::print(std::ostream& out, const char* title) const
+{
+	char line[128];
+	std::snprintf(line, sizeof line, "  %s: mean %.1f, max %llu\n", title,
+		count ? double(sum) / count : 0.0, static_cast<unsigned long long>(max));
+	out << line;
+
+	for (std::size_t i = 0; i < buckets.size(); i++)
+	{
+		if (!buckets[i]) continue;
+		const unsigned long long low = i ? 1ULL << (i - 1) : 0, high = i ? (1ULL << (i - 1)) * 2 - 1 : 0;
+		std::snprintf(line, sizeof line, "    %10llu - %-10llu %12llu  %5.1f%%\n", low, high,
+			static_cast<unsigned long long>(buckets[i]), 100.0 * buckets[i] / count);
+		out << line;
+	}
+}
+
+/**
+ * \brief Import statistics
+ *
+ * Time per stage, input volume, output rows and bytes per table and
+ * histograms of the line length and cast size.
+ *
+ * Counters are plain integers: every thread updates its own instance, without
+ * any synchronization, and instances are merged by the main thread (e.g. as
+ * the chunks of a parallel import are written out in order). Stage times are
+ * measured with a single clock reading at the end of every stage (see lap()).
+ */
+struct stats
+{
+	typedef std::chrono::steady_clock clock;
+
+	enum stage { read, split, genre, format, write, stages };
+
+	// Time spent per stage, in nanoseconds
+	std::array<std::uint64_t, stages> time{};
+
+	// Input lines and bytes (line feeds included)
+	std::uint64_t lines = 0, bytes = 0;
+
+	// Output rows and bytes per table, in order of appearance: table names
+	// are static schema strings, told apart by address
+	struct volume
+	{
+		const char* table;
+		std::uint64_t rows, bytes;
+	};
+
+	std::vector<volume> tables;
+
+	histogram line_length, cast_size;
+
+	// Add the time elapsed since a given time point to a stage, return now
+	clock::time_point lap(stage s, clock::time_point since)
+	{
+		const clock::time_point now = clock::now();
+		time[s] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count();
+		return now;
+	}
+
+	// Move the time of write(2) calls made while formatting to the write stage
+	void writes(std::uint64_t ns)
+	{
+		time[format] -= ns;
+		time[write] += ns;
+	}
+
+	// Count output rows and bytes of a table
+	void add(const char* table, std::uint64_t rows, std::uint64_t bytes);
+
+	void merge(const stats&);
+
+	// Print a one-line progress report, or the full summary
+	void progress(std::ostream&, double elapsed) const;
+	void print(std::ostream&, double elapsed) const;
+};
+
+inline void stats::add(const char* table, std::uint64_t rows, std::uint64_t bytes)
+{
+	for (auto& v: tables)
+		if (v.table == table)
+		{
+			v.rows += rows;
+			v.bytes += bytes;
+			return;
+		}
+	tables.push_back({ table, rows, bytes });
+}
+
+inline void stats::merge(const stats& s)
+{
+	for (std::size_t i = 0; i < stages; i++) time[i] += s.time[i];
+	lines += s.lines;
+	bytes += s.bytes;
+	for (const auto& v: s.tables) add(v.table, v.rows, v.bytes);
+	line_length.merge(s.line_length);
+	cast_size.merge(s.cast_size);
+}
+
+inline void stats::progress(std::ostream& out, double elapsed) const
+{
+	char line[160];
+	std::snprintf(line, sizeof line, "%.1f s: %llu lines, %.1f MB (%.0f lines/s, %.1f MB/s)\n",
+		elapsed, static_cast<unsigned long long>(lines), bytes / 1e6,
+		elapsed > 0 ? lines / elapsed : 0.0, elapsed > 0 ? bytes / elapsed / 1e6 : 0.0);
+	out << line;
+}
+
+inline void stats::print(std::ostream& out, double elapsed) const
+{
+	static constexpr const char* names[stages] = { "read", "split", "genre", "format", "write" };
+
+	char line[160];
+	out << "statistics\n  elapsed: ";
+	progress(out, elapsed);
+
+	// Stage times are summed over threads
+	std::uint64_t total = 0;
+	for (const auto t: time) total += t;
+	out << "  stages (thread time):\n";
+	for (std::size_t i = 0; i < stages; i++)
+	{
+		std::snprintf(line, sizeof line, "    %-8s %10.3f s  %5.1f%%\n", names[i], time[i] / 1e9,
+			total ? 100.0 * time[i] / total : 0.0);
+		out << line;
+	}
+
+	out << "  tables:\n";
+	for (const auto& v: tables)
+	{
+		std::snprintf(line, sizeof line, "    %-12s %12llu rows %12.1f MB\n", v.table,
+			static_cast<unsigned long long>(v.rows), v.bytes / 1e6);
+		out << line;
+	}
+
+	line_length.print(out, "line length (bytes)");
+	cast_size.print(out, "cast size (actors)");
+}
+
+
+#endif /* if __STATS_H__ */
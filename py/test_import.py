@@ -0,0 +1,1284 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  test_import.py
+#
+#  Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+
+"""
+Tests of the split program (see split.cpp), run on movies generated by
+genmovies.py. Programs are built with g++ into a temporary directory, once
+per set of compile options, and tests are skipped without g++ (or without an
+optional library, found through CPATH and LIBRARY_PATH as usual):
+
+	python3 -m unittest test_import
+"""
+
+import csv
+import gzip
+import io
+import json
+import os
+import random
+import re
+import select
+import shutil
+import sqlite3
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+import genmovies
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+_build_dir = None
+_programs = {}
+
+def program(source='split.cpp', *options):
+	""" Path of a program of this directory built with the given g++ options,
+	or skip the test if it can't be built (e.g. an optional library) """
+	global _build_dir
+	key = (source,) + options
+	if key not in _programs:
+		if not shutil.which('g++'):
+			raise unittest.SkipTest('g++ not found')
+		if not _build_dir:
+			_build_dir = tempfile.TemporaryDirectory(prefix='split-test-')
+		path = os.path.join(_build_dir.name, '%s-%d' % (os.path.splitext(source)[0], len(_programs)))
+		libraries = [o for o in options if o.startswith('-l') or o.endswith('.a')]
+		flags = [o for o in options if o not in libraries]
+		built = subprocess.run(['g++', '-std=c++17', '-O2', '-pthread'] + flags
+			+ ['-o', path, os.path.join(HERE, source)] + libraries,
+			stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+		_programs[key] = path if built.returncode == 0 else None
+	if not _programs[key]:
+		raise unittest.SkipTest('%s %s does not build' % (source, ' '.join(options)))
+	return _programs[key]
+
+def movies(lines=1000, **settings):
+	""" Generated movies.txt lines, as bytes (see genmovies.py) """
+	s = genmovies.arguments(['--lines', str(lines)])
+	vars(s).update(settings)
+	return ''.join(line + '\n' for line in genmovies.Generator(s).lines()).encode('utf-8')
+
+def split(*args, input=b'', build=(), check=True, cwd=None):
+	""" Run split with arguments on an input: return its output, or the
+	completed process if not checked """
+	done = subprocess.run([program('split.cpp', *build)] + list(args), input=input,
+		stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=cwd)
+	if not check:
+		return done
+	if done.returncode != 0:
+		raise AssertionError('split %s: %s' % (' '.join(args), done.stderr.decode()))
+	return done.stdout
+
+# Keys of mysql/CreateCB.sql: one character per actor and movie
+SCHEMA = '''
+	CREATE TABLE movies(id PRIMARY KEY, title, original_title, release_date, status,
+		vote_average, vote_count, runtime, certification, poster_path, budget, tag_line, genre);
+	CREATE TABLE people(id PRIMARY KEY, full_name);
+	CREATE TABLE directors(movie_id, director_id, PRIMARY KEY (movie_id, director_id));
+	CREATE TABLE characters(movie_id, actor_id, character_name, PRIMARY KEY (movie_id, actor_id));
+'''
+
+TABLES = ('movies', 'people', 'directors', 'characters')
+
+def load(*sql):
+	""" Rows of every table once PostgreSQL statements are run by SQLite,
+	which shares their INSERT ... ON CONFLICT syntax """
+	db = sqlite3.connect(':memory:')
+	db.executescript(SCHEMA)
+	for script in sql:
+		db.executescript(script.decode('utf-8'))
+	rows = { t: sorted(db.execute('SELECT * FROM ' + t), key=repr) for t in TABLES }
+	db.close()
+	return rows
+
+def merge(tables):
+	""" Rows of every table once given rows (a header first, None for NULL)
+	are loaded in order, duplicate keys ignored as on merging staging tables """
+	db = sqlite3.connect(':memory:')
+	db.executescript(SCHEMA)
+	for table, lines in tables.items():
+		db.executemany('INSERT OR IGNORE INTO %s(%s) VALUES (%s)' % (table, ', '.join(lines[0]),
+			', '.join('?' * len(lines[0]))), lines[1:])
+	rows = { t: sorted(db.execute('SELECT * FROM ' + t), key=repr) for t in TABLES }
+	db.close()
+	return rows
+
+def statements(sql, table):
+	""" Number of INSERT statements of a table """
+	return sum(1 for line in sql.decode('utf-8').splitlines()
+		if line.startswith(('INSERT IGNORE %s(' % table, 'INSERT INTO %s(' % table)))
+
+def search(snapshot, *queries):
+	""" Results of queries to the search engine, as lists of tuples """
+	done = subprocess.run([program('search.cpp'), snapshot], input=''.join(q + '\n' for q in queries).encode(),
+		stdout=subprocess.PIPE, check=True)
+	results = [[]]
+	for line in done.stdout.decode('utf-8').splitlines():
+		if line:
+			results[-1].append(tuple(line.split('\t')))
+		else:
+			results.append([])
+	return results[:-1]
+
+
+class BatchTest(unittest.TestCase):
+	""" Multi-row INSERT statements (--batch, --max-statement) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(2000)
+
+	def test_same_rows(self):
+		rows = load(split('--postgres', input=self.input))
+		for options in (['--batch', '1000'], ['--batch', '7'], ['--batch', '1000', '--max-statement', '4096']):
+			self.assertEqual(load(split('--postgres', *options, input=self.input)), rows, options)
+
+	def test_one_queue_per_table(self):
+		# Empty values are NULL rather than skipped: rows of different columns
+		# share statements, whose size is only bounded by children flushing
+		sql = split('--mysql', '--batch', '1000', input=self.input)
+		self.assertLessEqual(statements(sql, 'movies'), 2000 // 20)
+		self.assertIn(b'NULL', sql)
+		head = b'INSERT IGNORE movies(id, title, original_title, release_date, status, vote_average, ' \
+			b'vote_count, runtime, certification, poster_path, budget, tag_line, genre) VALUES ('
+		self.assertEqual(sum(1 for line in sql.splitlines() if line.startswith(head)), statements(sql, 'movies'))
+
+	def test_max_statement(self):
+		sql = split('--mysql', '--batch', '1000', '--max-statement', '4096', input=self.input)
+		for line in sql.splitlines():
+			if line.startswith(b'INSERT') and line.count(b'),(') > 0:
+				self.assertLessEqual(len(line) + 1, 4096)
+
+
+class CopyTest(unittest.TestCase):
+	""" PostgreSQL COPY output, text and binary (--copy, --binary) """
+
+	ESCAPES = { '\\': '\\', 't': '\t', 'n': '\n', 'r': '\r' }
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+		cls.rows = load(split('--postgres', input=cls.input))
+
+	@staticmethod
+	def array(elements):
+		""" A text array as the INSERT formatter writes it """
+		return '{' + ','.join(elements) + '}'
+
+	@staticmethod
+	def columns(sql):
+		""" Columns of the staging tables declared by a script """
+		return { m.group(1): m.group(2).replace(' text[]', '').replace(' text', '').split(', ')
+			for m in re.finditer(r'^CREATE TEMP TABLE (\w+)_stage \((.*)\);$', sql, re.M) }
+
+	def text(self, sql):
+		""" Rows of the COPY blocks of a script, per table """
+		tables = { t: [c] for t, c in self.columns(sql).items() }
+		table = None
+		for line in sql.splitlines():
+			if table and line == '\\.':
+				table = None
+			elif table:
+				row = [None if field == '\\N' else re.sub(r'\\(.)', lambda m: self.ESCAPES[m.group(1)], field)
+					for field in line.split('\t')]
+				if tables[table][0][-1] == 'genre':
+					row[-1] = self.array(re.sub(r'\\(.)', r'\1', e)
+						for e in re.findall(r'"((?:[^"\\]|\\.)*)"', row[-1]))
+				tables[table].append(row)
+			else:
+				copy = re.match(r'COPY (\w+)_stage FROM STDIN;$', line)
+				table = copy and copy.group(1)
+		return tables
+
+	def binary(self, data, columns):
+		""" Rows of a binary COPY file """
+		self.assertEqual(data[:19], b'PGCOPY\n\377\r\n\0' + bytes(8))
+		rows, at = [columns], 19
+		integer = lambda size: int.from_bytes(data[at:at + size], 'big', signed=True)
+		while integer(2) != -1:
+			self.assertEqual(integer(2), len(columns))
+			at += 2
+			row = []
+			for column in columns:
+				size = integer(4)
+				at += 4
+				value = data[at:at + max(size, 0)]
+				at += max(size, 0)
+				if size < 0:
+					row.append(None)
+				elif column == 'genre':
+					# Dimensions, null flag, text element type, then the size
+					# and lower bound of the only dimension
+					dimensions, nulls, oid = (int.from_bytes(value[i:i + 4], 'big') for i in (0, 4, 8))
+					self.assertEqual((nulls, oid), (0, 25))
+					elements, i = [], 12 + 8 * dimensions
+					if dimensions:
+						self.assertEqual(dimensions, 1)
+						self.assertEqual(int.from_bytes(value[16:20], 'big'), 1)
+					while i < len(value):
+						n = int.from_bytes(value[i:i + 4], 'big')
+						elements.append(value[i + 4:i + 4 + n].decode('utf-8'))
+						i += 4 + n
+					self.assertEqual(len(elements), int.from_bytes(value[12:16], 'big') if dimensions else 0)
+					row.append(self.array(elements))
+				else:
+					row.append(value.decode('utf-8'))
+			rows.append(row)
+		self.assertEqual(at + 2, len(data))
+		return rows
+
+	def test_text(self):
+		for size in ('4096', str(1 << 20)):
+			sql = split('--copy', '--max-statement', size, input=self.input).decode('utf-8')
+			self.assertEqual(merge(self.text(sql)), self.rows, size)
+			self.assertTrue(sql.startswith('BEGIN;\n') and sql.endswith('COMMIT;\n'))
+			self.assertEqual(sql.count('INSERT INTO '), len(TABLES))
+
+	def test_binary(self):
+		with tempfile.TemporaryDirectory() as directory:
+			sql = split('--copy', '--binary', directory, input=self.input).decode('utf-8')
+			tables = {}
+			for table, columns in self.columns(sql).items():
+				path = os.path.join(directory, table + '.pgcopy')
+				self.assertIn("\\copy %s_stage FROM '%s' WITH (FORMAT binary)" % (table, path), sql)
+				with open(path, 'rb') as f:
+					tables[table] = self.binary(f.read(), columns)
+		self.assertEqual(merge(tables), self.rows)
+		self.assertNotIn('COPY movies_stage FROM STDIN', sql)
+
+
+class DedupTest(unittest.TestCase):
+	""" Repeated people and characters rows suppressed (--dedup) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+
+	def test_same_rows(self):
+		sql = split('--postgres', input=self.input)
+		done = split('--postgres', '--dedup', input=self.input, check=False)
+		self.assertEqual(load(done.stdout), load(sql))
+
+		# Every person once, and the report counts the rows left out
+		rows = load(sql)
+		self.assertEqual(statements(done.stdout, 'people'), len(rows['people']))
+		self.assertEqual(statements(done.stdout, 'characters'), len(rows['characters']))
+		saved = re.search(r'duplicates suppressed: (\d+) people rows \((\d+) distinct\), (\d+) characters rows',
+			done.stderr.decode())
+		self.assertTrue(saved, done.stderr)
+		self.assertEqual([int(n) for n in saved.groups()], [statements(sql, 'people') - len(rows['people']),
+			len(rows['people']), statements(sql, 'characters') - len(rows['characters'])])
+
+	def test_repeated_lines(self):
+		# Movies imported twice add no people nor characters rows
+		once = split('--mysql', '--dedup', input=self.input)
+		twice = split('--mysql', '--dedup', input=self.input + self.input)
+		for table in ('people', 'characters'):
+			self.assertEqual(statements(twice, table), statements(once, table), table)
+		self.assertEqual(statements(twice, 'movies'), 2 * statements(once, 'movies'))
+
+
+class InputTest(unittest.TestCase):
+	""" Memory-mapped input files (--input) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+		cls.directory = tempfile.TemporaryDirectory()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	def assertMapped(self, data, *args):
+		""" A file is imported as the same data from a pipe """
+		path = os.path.join(self.directory.name, 'movies.txt')
+		with open(path, 'wb') as f:
+			f.write(data)
+		self.assertEqual(split('--mysql', '--input', path, *args), split('--mysql', *args, input=data))
+
+	def test_files(self):
+		self.assertMapped(self.input)
+		self.assertMapped(self.input.rstrip(b'\n'))		# Last line unterminated
+		self.assertMapped(b'')
+		self.assertMapped(b'\n\n')
+
+		# Ending at a page boundary, with and without a line feed
+		page = self.input[:self.input.index(b'\n', 8192) + 1]
+		page = page[:page.rindex(b'\n', 0, len(page) - 1) + 1]
+		page += b'9' * (3 * 4096 - len(page) - 1) + b'\n'
+		self.assertEqual(len(page) % 4096, 0)
+		self.assertMapped(page)
+		self.assertMapped(page[:-1] + b'x')
+
+	def test_long_lines(self):
+		# Lines across the 1 MB blocks of streamed input
+		data = movies(100, cast_mean=1000, cast_max=2000)
+		self.assertGreater(len(data), 2 << 20)
+		self.assertMapped(data)
+
+	def test_missing(self):
+		path = os.path.join(self.directory.name, 'missing.txt')
+		done = split('--mysql', '--input', path, check=False)
+		self.assertNotEqual(done.returncode, 0)
+		self.assertIn(path.encode(), done.stderr)
+
+
+class ParseTest(unittest.TestCase):
+	""" Nested fields found through the structural index (see structure) """
+
+	# Characters sharing the first bytes of the separators
+	LOOKALIKES = '\u2025\u2022\u2017\u2015\u203c\u2027'
+
+	@classmethod
+	def setUpClass(cls):
+		# Separators at every offset of 64-byte blocks, next to lookalikes
+		lines = []
+		for i, line in enumerate(movies(300).decode('utf-8').splitlines()):
+			fields = line.split('\u2023')
+			fields[1] = 'x' * (i % 64) + fields[1]
+			for f in (13, 14):
+				fields[f] = ''.join(cls.LOOKALIKES[j % len(cls.LOOKALIKES)] if c == ' ' and j % 3 else c
+					for j, c in enumerate(fields[f]))
+			lines.append('\u2023'.join(fields))
+		cls.lines = lines
+
+	def expected(self):
+		""" Rows of the lines, split by Python """
+		value = lambda v: v or None
+		tables = { t: set() for t in TABLES }
+		for line in self.lines:
+			fields = line.split('\u2023')
+			tables['movies'].add(tuple(map(value, fields[:12])))
+			for director in filter(None, fields[13].split('\u2016')):
+				id, name = director.split('\u2024')
+				tables['people'].add((id, value(name)))
+				tables['directors'].add((fields[0], id))
+			for actor in filter(None, fields[14].split('\u2016')):
+				id, name, character = actor.split('\u2024')
+				tables['people'].add((id, value(name)))
+				tables['characters'].add((fields[0], id, value(character)))
+		return tables
+
+	def test_rows(self):
+		rows = load(split('--postgres', input=''.join(l + '\n' for l in self.lines).encode('utf-8')))
+		rows['movies'] = [row[:12] for row in rows['movies']]
+		for table, expected in self.expected().items():
+			# Rows of other values for the same key are ignored
+			key = { 'people': 1, 'characters': 2 }.get(table)
+			self.assertLessEqual(set(rows[table]), expected, table)
+			self.assertEqual(len(rows[table]), len({ row[:key] for row in expected }), table)
+
+
+class QuoteTest(unittest.TestCase):
+	""" Quoted values (see writer::quoted), as loaded back """
+
+	def test_quotes(self):
+		# Values of quotes, of a few bytes to several vectors long
+		generator = random.Random(1)
+		titles = [''.join(generator.choice("''a\\\"") for _ in range(generator.randrange(1, 300)))
+			for _ in range(500)]
+		data = ''.join('%d\u2023%s%s\n' % (i + 1, t, '\u2023' * 13) for i, t in enumerate(titles)).encode('utf-8')
+		for args in (['--postgres'], ['--mysql'], ['--mysql', '--batch', '50']):
+			sql = split(*args, input=data).replace(b'INSERT IGNORE ', b'INSERT OR IGNORE INTO ')
+			self.assertEqual([row[1] for row in sorted(load(sql)['movies'], key=lambda row: int(row[0]))],
+				titles, args)
+
+
+class SchemaTest(unittest.TestCase):
+	""" INSERT heads rendered from the table schemas (see schema) """
+
+	@staticmethod
+	def created():
+		""" Columns of the tables of mysql/CreateCB.sql """
+		with open(os.path.join(HERE, 'mysql', 'CreateCB.sql'), encoding='utf-8') as f:
+			sql = re.sub(r'--.*', '', f.read())
+		return { m.group(1): set(re.findall(r'^\s*(\w+)\s+[A-Z]', m.group(2), re.M)) - { 'FOREIGN', 'UNIQUE' }
+			for m in re.finditer(r'CREATE TABLE (\w+) \((.*?)\n\);', sql, re.S) }
+
+	def test_heads(self):
+		# Columns of the database, in the order of the schema; single rows
+		# leave empty columns out, batches name them all
+		db = sqlite3.connect(':memory:')
+		db.executescript(SCHEMA)
+		columns = { t: [row[1] for row in db.execute('PRAGMA table_info(%s)' % t)] for t in TABLES }
+		db.close()
+		created = self.created()
+		self.assertEqual(set(columns), set(created))
+		for table in TABLES:
+			self.assertEqual(set(columns[table]), created[table], table)
+
+		data = movies(500)
+		for args in (['--mysql'], ['--postgres'], ['--mysql', '--batch', '10'], ['--postgres', '--batch', '10']):
+			heads = set(re.findall(r'^INSERT (?:IGNORE|INTO) (\w+)\(([^)]*)\) VALUES',
+				split(*args, input=data).decode('utf-8'), re.M))
+			self.assertEqual({ table for table, _ in heads }, set(TABLES), args)
+			for table, names in heads:
+				names = names.split(', ')
+				self.assertEqual(names, [c for c in columns[table] if c in names], args)
+				if '--batch' in args:
+					self.assertEqual(names, columns[table], args)
+
+
+class GenreTest(unittest.TestCase):
+	""" Genres as MySQL SET numbers and PostgreSQL arrays (see genre_set) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000, unknown_genres=0.2)
+		with open(os.path.join(HERE, 'mysql', 'CreateCB.sql'), encoding='utf-8') as f:
+			members = re.search(r'genre\s+SET\(([^)]*)\)', f.read()).group(1)
+		cls.members = re.findall(r"'([^']*)'", members)
+
+	def genres(self):
+		""" Known and unknown genre names of every movie, by id """
+		known, unknown = {}, 0
+		for line in self.input.decode('utf-8').splitlines():
+			fields = line.split('\u2023')
+			names = [g.split('\u2024')[1] for g in fields[12].split('\u2016') if g]
+			known[fields[0]] = [n for n in names if n in self.members]
+			unknown += len(names) - len(known[fields[0]])
+		return known, unknown
+
+	def test_mysql(self):
+		known, unknown = self.genres()
+		self.assertTrue(unknown)
+		done = split('--mysql', input=self.input, check=False)
+		self.assertIn(b'unknown genres skipped: %d\n' % unknown, done.stderr)
+		movies = load(done.stdout.replace(b'INSERT IGNORE ', b'INSERT OR IGNORE INTO '))['movies']
+		for row in movies:
+			bits = sum(1 << self.members.index(n) for n in known[row[0]])
+			self.assertEqual(row[-1], bits or None, row)
+
+	def test_postgres(self):
+		known, _ = self.genres()
+		for row in load(split('--postgres', input=self.input))['movies']:
+			names = sorted(known[row[0]], key=self.members.index)
+			self.assertEqual(row[-1], '{' + ','.join(names) + '}', row)
+
+
+class ThreadTest(unittest.TestCase):
+	""" Parallel chunked import (-j, --chunk), in input order """
+
+	# Threads and chunk sizes: a single worker, chunks of a few lines or of
+	# a line each, and a single chunk
+	SETTINGS = (('1', '65536'), ('4', '4096'), ('3', '100'), ('8', str(1 << 20)))
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(2000)
+		cls.directory = tempfile.TemporaryDirectory()
+		cls.path = os.path.join(cls.directory.name, 'movies.txt')
+		with open(cls.path, 'wb') as f:
+			f.write(cls.input)
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	def test_same_output(self):
+		for args in (['--mysql'], ['--postgres'], ['--postgres', '--validate']):
+			serial = split(*args, input=self.input)
+			for threads, chunk in self.SETTINGS:
+				options = args + ['-j', threads, '--chunk', chunk]
+				self.assertEqual(split(*options, input=self.input), serial, options)
+				self.assertEqual(split(*options, '--input', self.path), serial, options)
+
+	def test_batches(self):
+		# Chunks end their batches, hence the same rows in other statements
+		rows = load(split('--postgres', '--batch', '100', input=self.input))
+		for threads, chunk in self.SETTINGS:
+			self.assertEqual(load(split('--postgres', '--batch', '100', '-j', threads, '--chunk', chunk,
+				input=self.input)), rows, (threads, chunk))
+
+	def test_unsupported(self):
+		for args in (['--mysql', '--dedup'], ['--copy'], ['--mysql', '--state', os.path.join(self.directory.name, 's')]):
+			done = split(*args, '-j', '2', input=self.input, check=False)
+			self.assertNotEqual(done.returncode, 0, args)
+			self.assertFalse(done.stdout, args)
+
+
+class BulkTest(unittest.TestCase):
+	""" Per-table bulk-load files and their load.sql script (--bulk) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+
+	def files(self, directory):
+		""" Files of a bulk-load directory, by name """
+		files = {}
+		for name in os.listdir(directory):
+			with open(os.path.join(directory, name), 'rb') as f:
+				files[name] = f.read()
+		return files
+
+	def test_absolute_paths(self):
+		# A relative directory, from another working directory than the script's
+		with tempfile.TemporaryDirectory() as directory:
+			for dialect in ('--mysql', '--postgres'):
+				os.mkdir(os.path.join(directory, dialect[2:]))
+				split(dialect, '--bulk', dialect[2:], input=self.input, cwd=directory)
+				script = self.files(os.path.join(directory, dialect[2:]))['load.sql'].decode()
+				paths = re.findall(r"(?:INFILE|FROM) '([^']*)'", script)
+				self.assertEqual(sorted(os.path.basename(p) for p in paths), sorted(t + '.csv' for t in TABLES))
+				for path in paths:
+					self.assertTrue(os.path.isabs(path), path)
+					self.assertTrue(os.path.isfile(path), path)
+
+	def test_rows(self):
+		# CSV files, a header first, load the rows of the INSERT statements
+		# once duplicate keys are ignored as the script does
+		with tempfile.TemporaryDirectory() as directory:
+			split('--postgres', '--bulk', directory, input=self.input)
+			files = self.files(directory)
+		tables = {}
+		for table in TABLES:
+			lines = csv.reader(io.StringIO(files[table + '.csv'].decode('utf-8'), newline=''))
+			tables[table] = [next(lines)] + [[v or None for v in line] for line in lines]
+		self.assertEqual(merge(tables), load(split('--postgres', input=self.input)))
+
+
+class BenchmarkTest(unittest.TestCase):
+	""" Corpus generator (genmovies.py) and micro-benchmarks (bench.cpp) """
+
+	def test_generator(self):
+		# Seeded: the script writes the lines of the generator, and another
+		# seed makes another corpus
+		data = subprocess.run([sys.executable, os.path.join(HERE, 'genmovies.py'), '--lines', '300', '--seed', '7'],
+			stdout=subprocess.PIPE, check=True).stdout
+		self.assertEqual(data, movies(300, seed=7))
+		self.assertNotEqual(data, movies(300, seed=8))
+
+		lines = movies(300, cast_max=5, genres_max=2, unknown_genres=0).decode('utf-8').splitlines()
+		self.assertEqual([line.split('\u2023')[0] for line in lines], [str(i) for i in range(1, 301)])
+		for line in lines:
+			fields = line.split('\u2023')
+			self.assertEqual(len(fields), 15)
+			self.assertLessEqual(len(fields[12].split('\u2016')), 2)
+			self.assertNotIn('Foreign', fields[12])
+			self.assertLessEqual(len(fields[14].split('\u2016')), 5)
+
+	def test_bench(self):
+		# Every stage reports a time, as one JSON array
+		with tempfile.TemporaryDirectory() as directory:
+			corpus = os.path.join(directory, 'movies.txt')
+			with open(corpus, 'wb') as f:
+				f.write(movies(200))
+			stages = json.loads(subprocess.run([program('bench.cpp'), corpus, '0.01'],
+				stdout=subprocess.PIPE, check=True).stdout)
+		names = [stage['name'] for stage in stages]
+		for name in ('splitter', 'structure::build', 'record::parse', 'genres', 'insert/mysql', 'insert/copy'):
+			self.assertIn(name, names)
+		for stage in stages:
+			self.assertGreater(stage['runs'], 0, stage)
+			self.assertGreater(stage['seconds'], 0, stage)
+			self.assertGreaterEqual(stage['items'], 200, stage)
+
+
+class StateTest(unittest.TestCase):
+	""" Incremental import against a fingerprint index (--state) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+		cls.directory = tempfile.TemporaryDirectory()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	@staticmethod
+	def changed(data):
+		""" The lines of an input with some titles, directors and casts
+		changed, some lines removed and others added """
+		lines = []
+		for i, line in enumerate(data.decode('utf-8').splitlines()):
+			fields = line.split('\u2023')
+			if i % 10 == 1:
+				fields[1] += ' II'
+			elif i % 10 == 2:
+				fields[13] = ''
+			elif i % 10 == 3:
+				fields[14] = fields[14].split('\u2016')[-1]
+			elif i % 10 == 4:
+				continue
+			lines.append('\u2023'.join(fields))
+		extra = movies(1200).decode('utf-8').splitlines()[1000:]
+		return ''.join(l + '\n' for l in reversed(lines + extra)).encode('utf-8')
+
+	def test_delta(self):
+		# The delta applied to the first import makes the database of a full
+		# import, but for people, who are kept
+		state = os.path.join(self.directory.name, 'state')
+		first = split('--postgres', '--state', state, input=self.input)
+		self.assertEqual(first, split('--postgres', input=self.input))
+
+		unchanged = split('--postgres', '--state', state, input=self.input, check=False)
+		self.assertEqual(unchanged.stdout, b'')
+		self.assertIn(b'movies unchanged: 1000, changed: 0, new: 0, removed: 0', unchanged.stderr)
+
+		data = self.changed(self.input)
+		delta = split('--postgres', '--state', state, input=data, check=False)
+		self.assertEqual(delta.returncode, 0, delta.stderr)
+		ids = lambda data: { l.split(b'\xe2\x80\xa3')[0]: l for l in data.splitlines() }
+		old, new = ids(self.input), ids(data)
+		counts = (sum(1 for i in new if old.get(i) == new[i]), sum(1 for i in new if old.get(i, new[i]) != new[i]),
+			len(new.keys() - old.keys()), len(old.keys() - new.keys()))
+		self.assertIn(b'movies unchanged: %d, changed: %d, new: %d, removed: %d' % counts, delta.stderr)
+		self.assertTrue(all(counts))
+		self.assertLess(len(delta.stdout), len(split('--postgres', input=data)))
+		rows, expected = load(first, delta.stdout), load(split('--postgres', input=data))
+		for table in ('movies', 'directors', 'characters'):
+			self.assertEqual(rows[table], expected[table], table)
+		self.assertLessEqual({ row[0] for row in expected['people'] }, { row[0] for row in rows['people'] })
+
+		# The index now describes the new input
+		again = split('--postgres', '--state', state, input=data, check=False)
+		self.assertEqual(again.stdout, b'')
+
+	def test_invalid(self):
+		path = os.path.join(self.directory.name, 'invalid')
+		with open(path, 'wb') as f:
+			f.write(b'RQSTATE1' + bytes(20))
+		done = split('--postgres', '--state', path, input=self.input, check=False)
+		self.assertNotEqual(done.returncode, 0)
+		self.assertIn(b'not a fingerprint index', done.stderr)
+
+
+class SQLiteTest(unittest.TestCase):
+	""" SQLite database output (--sqlite, -DSPLIT_SQLITE) """
+
+	BUILD = ('-DSPLIT_SQLITE', '-lsqlite3')
+
+	def test_rows(self):
+		# The rows of the INSERT statements, run against the same schema
+		data = movies(1000)
+		data += data[:data.index(b'\n', len(data) // 2) + 1]		# Movies on two lines
+		with tempfile.TemporaryDirectory() as directory:
+			path = os.path.join(directory, 'movies.db')
+			split('--sqlite', path, input=data, build=self.BUILD)
+			db = sqlite3.connect(path)
+			self.assertEqual(db.execute('PRAGMA integrity_check').fetchone(), ('ok',))
+			self.assertEqual(db.execute('PRAGMA journal_mode').fetchone(), ('delete',))
+			schema = [row[0] for row in db.execute('SELECT sql FROM sqlite_master WHERE sql IS NOT NULL')]
+			rows = { t: sorted(db.execute('SELECT * FROM ' + t), key=repr) for t in TABLES }
+			db.close()
+
+		expected = sqlite3.connect(':memory:')
+		for sql in schema:
+			expected.execute(sql)
+		expected.executescript(split('--postgres', input=data).decode('utf-8'))
+		expected.execute("UPDATE movies SET genre = NULLIF(TRIM(genre, '{}'), '')")	# A list, as a SET
+		for table in TABLES:
+			self.assertEqual(rows[table], sorted(expected.execute('SELECT * FROM ' + table), key=repr), table)
+		expected.close()
+
+	def test_existing(self):
+		# Rows are added to an existing database, duplicates ignored
+		with tempfile.TemporaryDirectory() as directory:
+			path = os.path.join(directory, 'movies.db')
+			data = movies(500)
+			split('--sqlite', path, input=data[:len(data) // 2].rpartition(b'\n')[0] + b'\n', build=self.BUILD)
+			split('--sqlite', path, input=data, build=self.BUILD)
+			once = os.path.join(directory, 'once.db')
+			split('--sqlite', once, input=data, build=self.BUILD)
+			tables = []
+			for p in (path, once):
+				db = sqlite3.connect(p)
+				tables.append({ t: sorted(db.execute('SELECT * FROM ' + t), key=repr) for t in TABLES })
+				db.close()
+		self.assertEqual(tables[0]['movies'], tables[1]['movies'])
+		self.assertEqual(tables[0]['directors'], tables[1]['directors'])
+		self.assertEqual(tables[0]['characters'], tables[1]['characters'])
+
+
+class SnapshotTest(unittest.TestCase):
+	""" Columnar snapshots (--snapshot, see snapshot.h) """
+
+	FORMATS = { 0: 'B', 1: 'I', 2: 'Q', 3: 'f', 4: 'd', 5: 'c' }
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+		cls.directory = tempfile.TemporaryDirectory()
+		cls.path = os.path.join(cls.directory.name, 'movies.snap')
+		split('--snapshot', cls.path, input=cls.input)
+		with open(cls.path, 'rb') as f:
+			cls.data = f.read()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	def columns(self):
+		""" Descriptors of the columns, by name: type, width, count, offset """
+		magic, version, count, size = struct.unpack_from('=8sIIQ', self.data)
+		self.assertEqual((magic, version, size), (b'RQSNAP\0\0', 2, len(self.data)))
+		columns = {}
+		for i in range(count):
+			name, *descriptor = struct.unpack_from('=40sIIQQ', self.data, 24 + 64 * i)
+			columns[name.rstrip(b'\0').decode()] = descriptor
+		return columns
+
+	def values(self, name):
+		""" Values of a plain column """
+		type, width, count, offset = self.columns()[name]
+		return struct.unpack_from('=%d%s' % (count, self.FORMATS[type]), self.data, offset)
+
+	def strings(self, name):
+		""" Values of a string column """
+		offsets, data = self.values(name), self.columns()[name + '.data']
+		return [self.data[data[3] + a:data[3] + b].decode('utf-8') for a, b in zip(offsets, offsets[1:])]
+
+	def lists(self, name):
+		""" Rows of an adjacency column """
+		offsets, ids = self.values(name), self.values(name + '.ids')
+		return [list(ids[a:b]) for a, b in zip(offsets, offsets[1:])]
+
+	def test_layout(self):
+		# Aligned columns within the file, one after another
+		end = 24
+		for name, (type, width, count, offset) in sorted(self.columns().items(), key=lambda c: c[1][3]):
+			self.assertEqual(offset % 64, 0, name)
+			self.assertGreaterEqual(offset, end, name)
+			self.assertEqual(width, struct.calcsize(self.FORMATS[type]), name)
+			end = offset + width * count
+		self.assertLessEqual(end, len(self.data))
+
+	def test_values(self):
+		null = 0xffffffff
+		value = lambda v, f: f(v) if v else null
+		lines = [line.split('\u2023') for line in self.input.decode('utf-8').splitlines()]
+		with open(os.path.join(HERE, 'mysql', 'CreateCB.sql'), encoding='utf-8') as f:
+			sql = f.read()
+		status = re.findall(r"'([^']*)'", re.search(r'status\s+ENUM\(([^)]*)\)', sql).group(1))
+		self.assertEqual(self.values('movies.id'), tuple(int(l[0]) for l in lines))
+		self.assertEqual(self.strings('movies.title'), [l[1] for l in lines])
+		self.assertEqual(self.strings('movies.original_title'), [l[2] for l in lines])
+		self.assertEqual(self.values('movies.release_date'), tuple(value(l[3], lambda d: int(d.replace('-', ''))) for l in lines))
+		self.assertEqual(self.values('movies.status'), tuple(status.index(l[4]) if l[4] else 0xff for l in lines))
+		self.assertEqual(self.values('movies.vote_count'), tuple(value(l[6], int) for l in lines))
+		self.assertEqual([round(v, 1) if v == v else None for v in self.values('movies.vote_average')],
+			[float(l[5]) if l[5] else None for l in lines])
+		self.assertEqual(self.lists('movies.directors'),
+			[[int(d.split('\u2024')[0]) for d in l[13].split('\u2016') if d] for l in lines])
+		cast = [[c.split('\u2024') for c in l[14].split('\u2016') if c] for l in lines]
+		self.assertEqual(self.lists('movies.cast'), [[int(c[0]) for c in m] for m in cast])
+		self.assertEqual(self.strings('cast.character_name'), [c[2] for m in cast for c in m])
+
+		# People by id, named as first seen
+		people = {}
+		for l in lines:
+			for person in filter(None, l[13].split('\u2016') + l[14].split('\u2016')):
+				id, name = person.split('\u2024')[:2]
+				people.setdefault(int(id), name)
+		self.assertEqual(self.values('people.id'), tuple(sorted(people)))
+		self.assertEqual(self.strings('people.full_name'), [people[id] for id in sorted(people)])
+
+	def test_invalid(self):
+		# Truncated files and other versions are refused by the reader
+		for name, data in (('truncated', self.data[:len(self.data) // 2]), ('empty', b''),
+				('version', self.data[:8] + struct.pack('=I', 1) + self.data[12:])):
+			path = os.path.join(self.directory.name, name)
+			with open(path, 'wb') as f:
+				f.write(data)
+			done = subprocess.run([program('search.cpp'), path, 'id', '1'], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+			self.assertNotEqual(done.returncode, 0, name)
+			self.assertIn(path.encode() + (b': unsupported snapshot version 1' if name == 'version' else b''),
+				done.stderr, name)
+
+
+class SearchTest(unittest.TestCase):
+	""" Lookups of the search engine (search.cpp) over a snapshot """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(2000)
+		cls.directory = tempfile.TemporaryDirectory()
+		cls.snapshot = os.path.join(cls.directory.name, 'movies.snap')
+		split('--snapshot', cls.snapshot, input=cls.input)
+
+		# Movies by id and title, people by id (named as first seen) and the
+		# movies of every director and actor
+		cls.movies, cls.titles, cls.people = {}, {}, {}
+		cls.directed, cls.acted = {}, {}
+		for line in cls.input.decode('utf-8').splitlines():
+			fields = line.split('\u2023')
+			cls.movies[fields[0]] = (fields[0], fields[1])
+			cls.titles.setdefault(fields[1], set()).add(cls.movies[fields[0]])
+			for links, index in ((cls.directed, 13), (cls.acted, 14)):
+				for person in filter(None, fields[index].split('\u2016')):
+					id, name = person.split('\u2024')[:2]
+					cls.people.setdefault(id, name)
+					links.setdefault(id, set()).add(cls.movies[fields[0]])
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	def named(self, name):
+		""" Ids of the people of a name """
+		return [id for id, n in self.people.items() if n == name]
+
+	def test_movies(self):
+		ids = list(self.movies)[::97] + ['0', '99999', 'x']
+		titles = list(self.titles)[::89] + ['No such title']
+		results = search(self.snapshot, *(['id ' + i for i in ids] + ['title ' + t for t in titles]))
+		self.assertEqual(results[:len(ids)], [[self.movies[i]] if i in self.movies else [] for i in ids])
+		self.assertEqual([set(r) for r in results[len(ids):]], [self.titles.get(t, set()) for t in titles])
+
+	def test_people(self):
+		for command, links in (('director', self.directed), ('actor', self.acted)):
+			ids = sorted(links, key=int)[::37]
+			names = [self.people[id] for id in ids]
+			results = search(self.snapshot, *([command + ' ' + id for id in ids] + [command + ' ' + n for n in names]))
+			self.assertEqual([set(r) for r in results[:len(ids)]], [links[id] for id in ids], command)
+			self.assertEqual([set(r) for r in results[len(ids):]],
+				[set().union(*(links.get(id, set()) for id in self.named(n))) for n in names], command)
+
+		ids = sorted(self.people, key=int)[::53]
+		results = search(self.snapshot, *(['person ' + id for id in ids] + ['person ' + self.people[id] for id in ids]))
+		self.assertEqual(results[:len(ids)], [[(id, self.people[id])] for id in ids])
+		self.assertEqual([sorted(r) for r in results[len(ids):]],
+			[sorted((i, self.people[id]) for i in self.named(self.people[id])) for id in ids])
+
+	def test_unknown_query(self):
+		# Answered with an error and no result, the next query still answered
+		done = subprocess.run([program('search.cpp'), self.snapshot], input=b'year 2001\nid 1\n',
+			stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+		self.assertIn(b'unknown query year', done.stderr)
+		self.assertEqual(done.stdout.decode('utf-8'), '\n%s\t%s\n\n' % self.movies['1'])
+
+
+class SpliceTest(unittest.TestCase):
+	""" Output handed to a pipe with vmsplice (--splice) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(3000)
+		cls.output = split('--mysql', input=cls.input)
+
+	def test_pipe(self):
+		for args in (['--splice'], ['--splice', '-j', '3', '--chunk', '65536'], ['--splice', '--batch', '100']):
+			expected = split('--mysql', *args[1:], input=self.input)
+			self.assertEqual(split('--mysql', *args, input=self.input), expected, args)
+
+	def test_slow_reader(self):
+		# Pages are kept until read, whatever the reader's pace
+		with tempfile.TemporaryFile() as source:
+			source.write(self.input)
+			source.seek(0)
+			with subprocess.Popen([program('split.cpp'), '--mysql', '--splice'], stdin=source,
+					stdout=subprocess.PIPE, stderr=subprocess.DEVNULL) as process:
+				blocks = []
+				for block in iter(lambda: process.stdout.read(4096), b''):
+					blocks.append(block)
+					if len(blocks) % 64 == 0:
+						time.sleep(0.05)
+			self.assertEqual(process.returncode, 0)
+		self.assertEqual(b''.join(blocks), self.output)
+
+	def test_file(self):
+		# Not a pipe: written as usual
+		with tempfile.TemporaryFile() as output:
+			subprocess.run([program('split.cpp'), '--mysql', '--splice'], input=self.input,
+				stdout=output, stderr=subprocess.DEVNULL, check=True)
+			output.seek(0)
+			self.assertEqual(output.read(), self.output)
+
+
+class FilterTest(unittest.TestCase):
+	""" Movie id filters (--ids, --id-range) """
+
+	@classmethod
+	def setUpClass(cls):
+		# A large id too, which makes sparse lists
+		lines = movies(2000).splitlines(keepends=True)
+		cls.input = b''.join(lines) + b'4000000000' + lines[5][lines[5].index(b'\xe2'):]
+		cls.directory = tempfile.TemporaryDirectory()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	def selected(self, select):
+		""" The input lines whose id is selected, as a prefilter would pass """
+		return b''.join(line for line in self.input.splitlines(keepends=True)
+			if select(int(line[:line.index(b'\xe2')])))
+
+	def assertFilters(self, args, select):
+		expected = split('--mysql', input=self.selected(select))
+		self.assertEqual(split('--mysql', *args, input=self.input), expected, args)
+		self.assertEqual(split('--mysql', *args, '-j', '2', '--chunk', '65536', input=self.input), expected, args)
+
+	def test_ids(self):
+		ids = { 1, 2, 64, 65, 999, 2000 }
+		self.assertFilters(['--ids', ','.join(map(str, ids))], ids.__contains__)
+		self.assertFilters(['--ids', '7,4000000000'], { 7, 4000000000 }.__contains__)
+
+		# A file, of ids separated by line feeds, blanks and commas
+		path = os.path.join(self.directory.name, 'ids.txt')
+		with open(path, 'w') as f:
+			f.write('3\n10 11\t12,13\r\n\n1500\n')
+		self.assertFilters(['--ids', path], { 3, 10, 11, 12, 13, 1500 }.__contains__)
+
+	def test_ranges(self):
+		self.assertFilters(['--id-range', '100-199'], lambda id: 100 <= id <= 199)
+		self.assertFilters(['--id-range', '100-199', '--id-range', '1990-4000000000', '--ids', '5'],
+			lambda id: 100 <= id <= 199 or id >= 1990 or id == 5)
+
+	def test_invalid(self):
+		path = os.path.join(self.directory.name, 'bad.txt')
+		with open(path, 'w') as f:
+			f.write('1\n2x\n')
+		for args, message in ((['--id-range', '5-3'], b'--id-range expects A-B'), (['--id-range', '5'], b'--id-range'),
+				(['--ids', path], b'invalid movie id 2x'), (['--ids', '1,99999999999'], b'invalid movie id')):
+			done = split('--mysql', *args, input=self.input, check=False)
+			self.assertNotEqual(done.returncode, 0, args)
+			self.assertIn(message, done.stderr, args)
+
+
+class ShardTest(unittest.TestCase):
+	""" SQL statements sharded by key (--shards, --output-dir) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(2000)
+		cls.rows = load(split('--postgres', input=cls.input))
+
+	def shards(self, directory, count):
+		""" Scripts of the shards, the statements of the session settings
+		(foreign key checks) left out """
+		scripts = []
+		for k in range(count):
+			with open(os.path.join(directory, 'shard-%d.sql' % k), 'rb') as f:
+				lines = f.read().splitlines(keepends=True)
+			self.assertTrue(lines[0].startswith(b'SET '), lines[0])
+			scripts.append(b''.join(lines[1:]))
+		self.assertEqual(sorted(os.listdir(directory)), ['shard-%d.sql' % k for k in range(count)])
+		return scripts
+
+	def test_rows(self):
+		for args in (['--shards', '4'], ['--shards', '3', '--batch', '50'], ['--shards', '1']):
+			with tempfile.TemporaryDirectory() as directory:
+				self.assertEqual(split('--postgres', *args, '--output-dir', directory, input=self.input), b'')
+				scripts = self.shards(directory, int(args[1]))
+			self.assertEqual(load(*scripts), self.rows, args)
+
+	def test_keys(self):
+		# Every person, and every movie with its links, goes to a single
+		# shard, in input order
+		with tempfile.TemporaryDirectory() as directory:
+			split('--mysql', '--shards', '4', '--batch', '20', '--output-dir', directory, input=self.input)
+			scripts = self.shards(directory, 4)
+		owners = {}
+		for k, script in enumerate(scripts):
+			movies = []
+			for line in script.decode('utf-8').splitlines():
+				table = re.match(r'INSERT IGNORE (\w+)\(', line).group(1)
+				for key in re.findall(r"(?:VALUES |\),)\('([^']*)'", line):
+					self.assertEqual(owners.setdefault((table == 'people', key), k), k, line)
+					if table == 'movies':
+						movies.append(int(key))
+			self.assertEqual(movies, sorted(movies))
+		self.assertGreater(len({ k for k in owners.values() }), 1)
+
+	def test_fifos(self):
+		# Existing FIFOs, read by running loaders
+		with tempfile.TemporaryDirectory() as directory:
+			paths = [os.path.join(directory, 'shard-%d.sql' % k) for k in range(3)]
+			for path in paths:
+				os.mkfifo(path)
+			outputs = [tempfile.TemporaryFile() for path in paths]
+			readers = [subprocess.Popen(['cat', path], stdout=output) for path, output in zip(paths, outputs)]
+			split('--postgres', '--shards', '3', '--output-dir', directory, input=self.input)
+			scripts = []
+			for reader, output in zip(readers, outputs):
+				self.assertEqual(reader.wait(), 0)
+				output.seek(0)
+				scripts.append(output.read())
+				output.close()
+		self.assertEqual(load(*(s[s.index(b'\n') + 1:] for s in scripts)), self.rows)
+
+	def test_options(self):
+		for args in (['--mysql', '--shards', '2'], ['--mysql', '--output-dir', '.'], ['--copy', '--shards', '2', '--output-dir', '.']):
+			done = split(*args, input=self.input, check=False)
+			self.assertNotEqual(done.returncode, 0, args)
+			self.assertIn(b'--shards and --output-dir go together', done.stderr, args)
+
+
+class ValidationTest(unittest.TestCase):
+	""" Schema validation (--validate, --reject) """
+
+	LENGTHS = { 'movies': { 1: 63, 2: 63, 11: 79 }, 'people': { 1: 31 }, 'characters': { 2: 31 } }
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000, title_words=8)
+
+	def assertFits(self, rows):
+		for table, lengths in self.LENGTHS.items():
+			for row in rows[table]:
+				for column, length in lengths.items():
+					self.assertLessEqual(len(row[column] or ''), length, (table, row))
+
+	def test_fix(self):
+		done = split('--postgres', '--validate', input=self.input, check=False)
+		self.assertEqual(done.returncode, 0)
+		rows = load(done.stdout)
+		self.assertEqual(len(rows['movies']), 1000)
+		self.assertFits(rows)
+		self.assertRegex(done.stderr.decode(), r'movies\.title +[1-9]\d* truncated')
+
+		# Threads count the same
+		threaded = split('--postgres', '--validate', '-j', '4', '--chunk', '65536', input=self.input, check=False)
+		self.assertEqual(threaded.stdout, done.stdout)
+		self.assertEqual(threaded.stderr, done.stderr)
+
+	def test_reject(self):
+		with tempfile.TemporaryDirectory() as directory:
+			rejects = os.path.join(directory, 'rejects.txt')
+			rows = load(split('--postgres', '--reject', rejects, input=self.input))
+			with open(rejects, 'rb') as f:
+				rejected = f.read()
+			self.assertFits(rows)
+			self.assertTrue(rejected)
+			self.assertEqual(len(rows['movies']) + rejected.count(b'\n'), 1000)
+
+			# Rejected lines are whole input lines, in input order
+			lines = self.input.splitlines(keepends=True)
+			self.assertEqual([l for l in lines if l in set(rejected.splitlines(keepends=True))],
+				rejected.splitlines(keepends=True))
+
+			split('--postgres', '--reject', rejects + '.j', '-j', '4', '--chunk', '65536', input=self.input)
+			with open(rejects + '.j', 'rb') as f:
+				self.assertEqual(f.read(), rejected)
+
+
+class StatsTest(unittest.TestCase):
+	""" Import statistics (--stats) """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+
+	@staticmethod
+	def tables(stderr):
+		""" Rows per table of a report """
+		return { m.group(1): int(m.group(2))
+			for m in re.finditer(r'^ {4}(\w+) +(\d+) rows', stderr.decode(), re.M) }
+
+	def test_rows(self):
+		done = split('--mysql', '--stats', input=self.input, check=False)
+		self.assertEqual(done.returncode, 0)
+		self.assertEqual(self.tables(done.stderr), { t: statements(done.stdout, t) for t in TABLES })
+		for stage in ('read', 'split', 'genre', 'format', 'write'):
+			self.assertRegex(done.stderr.decode(), r'\n {4}%s +\d' % stage)
+
+		# Batched and threaded imports count the same rows
+		for options in (['--batch', '100'], ['-j', '4', '--chunk', '65536']):
+			other = split('--mysql', '--stats', *options, input=self.input, check=False)
+			self.assertEqual(self.tables(other.stderr), self.tables(done.stderr), options)
+
+
+class AllocationTest(unittest.TestCase):
+	""" No heap allocation per line, past a warm-up (-DSPLIT_COUNT_ALLOCATIONS) """
+
+	BUILD = ('-DSPLIT_COUNT_ALLOCATIONS',)
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(3000)
+		cls.directory = tempfile.TemporaryDirectory()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	def allocating(self, *args, build=BUILD, input=None):
+		""" Number of lines which allocated memory """
+		done = split(*args, input=self.input if input is None else input, build=build, check=False)
+		found = re.search(rb'(\d+) of (\d+) lines allocated', done.stderr)
+		self.assertTrue(found, done.stderr)
+		return int(found.group(1))
+
+	def test_streamed_outputs(self):
+		d = self.directory.name
+		for args in (['--mysql'], ['--postgres'], ['--mysql', '--batch', '1000'], ['--postgres', '--batch', '1000'],
+				['--mysql', '--batch', '1000', '--max-statement', '8192'], ['--copy'],
+				['--copy', '--binary', d], ['--mysql', '--bulk', d], ['--postgres', '--bulk', d],
+				['--mysql', '--dedup'], ['--mysql', '--validate'], ['--mysql', '--reject', os.path.join(d, 'rejects')],
+				['--mysql', '--id-range', '1-1500'], ['--mysql', '--stats'],
+				['--mysql', '--shards', '3', '--output-dir', d]):
+			self.assertEqual(self.allocating(*args), 0, args)
+
+	def test_sqlite(self):
+		self.assertEqual(self.allocating('--sqlite', os.path.join(self.directory.name, 'movies.db'),
+			build=self.BUILD + ('-DSPLIT_SQLITE', '-lsqlite3')), 0)
+
+	def test_accumulated_outputs(self):
+		# Whole-import arrays only allocate as they double: 4 times as many
+		# lines make a few more allocations, not 4 times as many
+		d = self.directory.name
+		more = movies(12000)
+		for args in (['--snapshot', 'movies.snap'], ['--mysql', '--state', 'state']):
+			few = self.allocating(*args[:-1], os.path.join(d, args[-1] + '.few'))
+			many = self.allocating(*args[:-1], os.path.join(d, args[-1] + '.many'), input=more)
+			self.assertLessEqual(many, few + 32, args)
+
+
+class DecodeTest(unittest.TestCase):
+	""" Compressed input, gzip and zstd (-DSPLIT_GZIP, -DSPLIT_ZSTD) """
+
+	GZIP = ('-DSPLIT_GZIP', '-lz')
+	ZSTD = ('-DSPLIT_ZSTD', '-lzstd')
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(1000)
+		cls.output = split('--mysql', input=cls.input)
+		cls.directory = tempfile.TemporaryDirectory()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	def zstd(self, data, *options):
+		""" Data compressed by the zstd program """
+		if not shutil.which('zstd'):
+			self.skipTest('zstd not found')
+		return subprocess.run(['zstd', '-q', '-c'] + list(options), input=data,
+			stdout=subprocess.PIPE, check=True).stdout
+
+	def assertDecodes(self, data, build):
+		""" Compressed data, from stdin, a file and a pipe delivering a byte
+		first, is imported as the plain input """
+		self.assertEqual(split('--mysql', input=data, build=build), self.output)
+		path = os.path.join(self.directory.name, 'input')
+		with open(path, 'wb') as f:
+			f.write(data)
+		self.assertEqual(split('--mysql', '--input', path, build=build), self.output)
+
+		process = subprocess.Popen([program('split.cpp', *build), '--mysql'],
+			stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+		process.stdin.write(data[:1])
+		process.stdin.flush()
+		time.sleep(0.1)
+		output, _ = process.communicate(data[1:])
+		self.assertEqual(output, self.output)
+
+	def test_gzip(self):
+		self.assertDecodes(gzip.compress(self.input), self.GZIP)
+
+		# Concatenated members, e.g. from parallel compressors
+		half = self.input.index(b'\n', len(self.input) // 2) + 1
+		self.assertDecodes(gzip.compress(self.input[:half]) + gzip.compress(self.input[half:]), self.GZIP)
+
+	def test_zstd(self):
+		self.assertDecodes(self.zstd(self.input), self.ZSTD)
+
+		# Frames decoded in parallel or streamed, empty ones included
+		half = self.input.index(b'\n', len(self.input) // 2) + 1
+		empty, unsized = self.zstd(b''), self.zstd(b'', '--no-content-size')
+		self.assertDecodes(empty + self.zstd(self.input[:half]) + empty + unsized
+			+ self.zstd(self.input[half:], '--no-content-size') + empty, self.ZSTD)
+
+	def test_unavailable(self):
+		done = split('--mysql', input=gzip.compress(self.input), check=False)
+		self.assertNotEqual(done.returncode, 0)
+		self.assertIn(b'gzip input is not available', done.stderr)
+
+	def test_short_first_line(self):
+		# Interactive input isn't held back waiting for a magic number
+		snapshot = os.path.join(self.directory.name, 'movies.snap')
+		split('--snapshot', snapshot, input=self.input)
+		with subprocess.Popen([program('search.cpp'), snapshot],
+				stdin=subprocess.PIPE, stdout=subprocess.PIPE) as process:
+			try:
+				process.stdin.write(b'x\n')
+				process.stdin.flush()
+				ready, _, _ = select.select([process.stdout], [], [], 10)
+				self.assertTrue(ready, 'no answer to a 2-byte query')
+				self.assertEqual(process.stdout.readline(), b'\n')
+			finally:
+				process.kill()
+
+class TrigramTest(unittest.TestCase):
+	""" Substring search through the trigram indexes of a snapshot """
+
+	@classmethod
+	def setUpClass(cls):
+		cls.input = movies(2000)
+		cls.directory = tempfile.TemporaryDirectory()
+		cls.snapshot = os.path.join(cls.directory.name, 'movies.snap')
+		split('--snapshot', cls.snapshot, input=cls.input)
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.directory.cleanup()
+
+	@staticmethod
+	def fold(text):
+		# As trigram::fold(): ASCII and Latin-1 capitals only
+		return ''.join(c.lower() if c < '\x80' or ('\xc0' <= c <= '\xde' and c != '\xd7') else c for c in text)
+
+	def expected(self, text):
+		""" Ids of the movies whose title or original title contains a text """
+		ids = set()
+		for line in self.input.decode('utf-8').splitlines():
+			fields = line.split('\u2023')
+			if any(self.fold(text) in self.fold(title) for title in fields[1:3]):
+				ids.add(fields[0])
+		return ids
+
+	def test_names(self):
+		# Substrings of names, short ones (scanned) included, and no match
+		people = {}
+		for line in self.input.decode('utf-8').splitlines():
+			for person in filter(None, '\u2016'.join(line.split('\u2023')[13:15]).split('\u2016')):
+				id, name = person.split('\u2024')[:2]
+				people.setdefault(id, name)
+		queries = ['sel', 'Zu', 'a', "n'o", 'belchema', 'xyzzy']
+		for query, rows in zip(queries, search(self.snapshot, *('name-contains ' + q for q in queries))):
+			with self.subTest(query=query):
+				self.assertEqual(sorted(rows), sorted((id, name) for id, name in people.items()
+					if self.fold(query) in self.fold(name)))
+
+	def test_title_case(self):
+		# Latin-1 capitals, in words of the generated titles (e.g. "Éstosto")
+		words = { w for line in self.input.decode('utf-8').splitlines()
+			for w in line.split('\u2023')[1].split() if w[0] in 'ÉÀÈ' }
+		self.assertTrue(words)
+		queries = []
+		for word in sorted(words)[:5]:
+			queries += [word, word.lower(), word.upper(), word[:2].lower()]
+		for query, rows in zip(queries, search(self.snapshot, *('title-contains ' + q for q in queries))):
+			with self.subTest(query=query):
+				self.assertTrue(rows)
+				self.assertEqual({ row[0] for row in rows }, self.expected(query))
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,240 @@
+/**
+ * test_scan.cpp
+ *
+ * DESCRIPTION
+ *
+ * Checks every vector kernel of scan.h which the CPU supports against its
+ * scalar fallback, on random strings of delimiter bytes and on delimiters
+ * placed across vector boundaries, at every alignment and start position,
+ * then the escape kernels on strings of quotes, backslashes and NULs, and
+ * the quoting of writer (output.h) into page-aligned pipe buffers:
+ *
+ *	g++ -std=c++17 -O2 -o test_scan test_scan.cpp
+ *	./test_scan
+ *
+ * The first mismatch is printed, and makes the exit status a failure. The
+ * test_scan.py driver builds and runs it.
+ *
+ * LICENSING
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "scan.h"
+#include "output.h"
+
+// Separators of movies.txt, and other marks the kernels may be given
+static const std::string_view marks[] = {
+	"‖", "‣", "․", "\xe2\x80", "\xe2", "\xe2\x80\x96\xe2", ""
+};
+
+// Bytes of random strings: those of the separators, and others
+static constexpr char alphabet[] = "\xe2\x80\x96\xa3\xa4" "a'\\";
+
+/**
+ * \brief Test strings
+ *
+ * Random strings up to a few vectors long, then strings of plain bytes with
+ * a separator at every position around the vector boundaries and the end.
+ * Every string is copied at every alignment of a 64-byte vector, before bytes
+ * which would complete a separator, should a kernel read past the end.
+ */
+struct cases
+{
+	std::mt19937 random{1};
+	std::string storage;
+
+	template <typename Function>
+	void each(Function&& f)
+	{
+		for (std::size_t n = 0; n < 500; n++)
+		{
+			std::string s(random() % 300, 0);
+			for (auto& c: s) c = alphabet[random() % (sizeof alphabet - 1)];
+			aligned(s, f);
+		}
+
+		for (const std::size_t size: { 16, 17, 31, 32, 33, 63, 64, 65, 130 })
+			for (const std::string_view mark: marks)
+				for (std::size_t at = 0; at + mark.size() <= size; at++)
+				{
+					std::string s(size, 'a');
+					s.replace(at, mark.size(), mark);
+					aligned(s, f);
+				}
+	}
+
+	template <typename Function>
+	void aligned(const std::string& s, Function&& f)
+	{
+		storage.assign(s.size() + 192, 0);
+		const std::size_t base = (64 - reinterpret_cast<std::uintptr_t>(storage.data()) % 64) % 64;
+		for (std::size_t shift = 0; shift < 64; shift += s.size() > 64 ? 7 : 1)
+		{
+			char* p = storage.data() + base + shift;
+			std::memcpy(p, s.data(), s.size());
+			std::memset(p + s.size(), '\xa3', 64);		// Ends a mark if read
+			f(std::string_view(p, s.size()));
+		}
+	}
+};
+
+static int failures = 0;
+
+static void fail(const char* kernel, std::string_view s, const char* what)
+{
+	if (failures++) return;
+	std::printf("%s: %s on \"", kernel, what);
+	for (const unsigned char c: s.substr(0, 160)) std::printf(c >= 32 && c < 127 ? "%c" : "\\x%02x", c);
+	std::printf("%s\" (%zu bytes)\n", s.size() > 160 ? "..." : "", s.size());
+}
+
+// Check a find kernel at every start position, with every mark
+static void find(const char* name, scan::kernel k)
+{
+	std::size_t checks = 0;
+	cases().each([&](std::string_view s)
+	{
+		for (const std::string_view mark: marks)
+			for (std::size_t pos = 0; pos <= s.size() + 1; pos++, checks++)
+				if (k(s, mark, pos) != scan::find_scalar(s, mark, pos)) fail(name, s, "find");
+	});
+	std::printf("%s: %zu checks\n", name, checks);
+}
+
+// Check a marks kernel on the separators, one per last byte
+static void structure(const char* name, scan::marks_kernel k)
+{
+	static constexpr char last[] = { '\xa3', '\x96', '\xa4' };
+	std::size_t checks = 0;
+	std::vector<std::uint64_t> expected, found;
+	cases().each([&](std::string_view s)
+	{
+		const std::size_t words = 3 * (s.size() / 64 + 1);
+		expected.assign(words + 1, 7);
+		found.assign(words + 1, 7);		// The last one is past the end
+		scan::marks_scalar(s, "\xe2\x80", last, expected.data());
+		k(s, "\xe2\x80", last, found.data());
+		if (found != expected) fail(name, s, "marks");
+		checks++;
+	});
+	std::printf("%s: %zu checks\n", name, checks);
+}
+
+// Random strings of quotes, backslashes and NULs (and a few plain bytes)
+static std::string quotable(std::mt19937& random)
+{
+	static constexpr char bytes[] = { '\'', '"', '\\', '\0', 'a' };
+	std::string s(random() % 300, 0);
+	for (auto& c: s) c = bytes[random() % sizeof bytes];
+	return s;
+}
+
+// Check an escape kernel with both quote marks, at every source alignment
+static void escape(const char* name, scan::escape_kernel k)
+{
+	std::size_t checks = 0;
+	std::mt19937 random{2};
+	std::string storage, expected, found;
+	for (std::size_t n = 0; n < 2000; n++)
+	{
+		const std::string s = quotable(random);
+		storage.assign(s.size() + 64, 0);
+		for (const char quote: { '\'', '"' })
+			for (std::size_t shift = 0; shift < 64; shift += 5, checks++)
+			{
+				std::memcpy(&storage[shift], s.data(), s.size());
+				expected.assign(2 * s.size() + scan::escape_padding, 0);
+				found.assign(expected.size(), 0);
+				expected.resize(scan::escape_scalar(s.data(), s.size(), &expected[0], quote));
+				found.resize(k(&storage[shift], s.size(), &found[0], quote));
+				if (found != expected) fail(name, s, "escape");
+			}
+	}
+	std::printf("%s: %zu checks\n", name, checks);
+}
+
+// Check that quoted values larger than a spliced writer's buffer keep it page
+// aligned when grown, and come out as escape_scalar() does
+static void spliced()
+{
+	int fds[2];
+	if (::pipe(fds) < 0) throw std::system_error(errno, std::generic_category(), "pipe");
+
+	const std::size_t page = ::sysconf(_SC_PAGESIZE);
+	std::mt19937 random{3};
+	std::string expected;
+	{
+		writer out(fds[1], page);
+		if (!out.splice()) fail("writer", "", "splice");
+		for (std::size_t size = page / 2; size < 16 * page; size *= 2)
+		{
+			std::string s;
+			while (s.size() < size) s += quotable(random);
+
+			// Empty, hence grown without flushing: nothing is sent, and no
+			// reader is needed
+			out.clear();
+			out.quoted(s);
+			expected.assign(2 * s.size() + scan::escape_padding, 0);
+			expected.resize(scan::escape_scalar(s.data(), s.size(), &expected[0], '\''));
+			expected = "'" + expected + "'";
+
+			if (reinterpret_cast<std::uintptr_t>(out.view().data()) % page) fail("writer", s, "unaligned buffer");
+			if (out.view() != expected) fail("writer", s, "quoted");
+		}
+		out.clear();
+	}
+	::close(fds[0]);
+	::close(fds[1]);
+	std::printf("writer: spliced\n");
+}
+
+int main()
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	find("find_sse2", scan::find_sse2);
+	structure("marks_sse2", scan::marks_sse2);
+	escape("escape_sse2", scan::escape_sse2);
+	if (__builtin_cpu_supports("avx2"))
+	{
+		find("find_avx2", scan::find_avx2);
+		structure("marks_avx2", scan::marks_avx2);
+		escape("escape_avx2", scan::escape_avx2);
+	}
+	else std::printf("avx2: not supported\n");
+	if (__builtin_cpu_supports("avx512bw"))
+	{
+		find("find_avx512", scan::find_avx512);
+		structure("marks_avx512", scan::marks_avx512);
+		escape("escape_avx512", scan::escape_avx512);
+	}
+	else std::printf("avx512bw: not supported\n");
+#else
+	std::printf("no vector kernels\n");
+#endif
+	spliced();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  test_scan.py
+#
+#  Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+
+"""
+Tests of the vector kernels of scan.h against their scalar fallbacks, and
+of quoting into spliced output buffers, run by test_scan.cpp (built as the
+programs of test_import.py):
+
+	python3 -m unittest test_scan
+"""
+
+import subprocess
+import unittest
+
+from test_import import program
+
+class KernelTest(unittest.TestCase):
+	def test_kernels(self):
+		done = subprocess.run([program('test_scan.cpp')], stdout=subprocess.PIPE)
+		report = done.stdout.decode()
+		self.assertEqual(done.returncode, 0, report)
+		self.assertIn('find_sse2:', report)
+		self.assertIn('escape_sse2:', report)
+		self.assertIn('writer: spliced', report)
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  test_split.py
+#
+#  Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+
+"""
+Tests of the _split extension (see splitmodule.c), skipped unless built:
+
+	python3 -m unittest test_split
+"""
+
+import os
+import shutil
+import subprocess
+import sys
+import unittest
+
+from test_import import HERE, movies
+
+try:
+	import _split
+except ImportError:
+	_split = None
+
+MOVIE = ('1', 'Title', '', '2001-01-01', 'Released', '', '', '', '', '', '', '')
+
+@unittest.skipUnless(_split, '_split extension not built')
+class FormatterTest(unittest.TestCase):
+	def test_mysql_genre_set(self):
+		mysql = _split.Formatter('mysql')
+		genre = mysql.genres(['Drama', 'Action', 'Unknown'])
+		self.assertTrue(genre.isdigit())
+		self.assertIn(', ' + genre + ')', mysql.insert('movies', MOVIE + (genre,)))
+
+	def test_mysql_genre_injection(self):
+		mysql = _split.Formatter('mysql')
+		for genre in ('1); DROP TABLE movies; --', 'Drama', '1,2', '-1'):
+			with self.assertRaises(ValueError):
+				mysql.insert('movies', MOVIE + (genre,))
+
+	def test_quoted_values(self):
+		postgres = _split.Formatter('postgres')
+		statement = postgres.insert('people', ('1', "O'Neil'); DROP TABLE people; --"))
+		self.assertIn("'O''Neil''); DROP TABLE people; --'", statement)
+		self.assertIn("'{Drama}'", postgres.insert('movies', MOVIE + ('{Drama}',)))
+
+	def test_uninitialized(self):
+		formatter = _split.Formatter.__new__(_split.Formatter)
+		with self.assertRaises(RuntimeError):
+			formatter.insert('people', ('1', 'Name'))
+		with self.assertRaises(RuntimeError):
+			formatter.genres(['Drama'])
+
+@unittest.skipUnless(_split, '_split extension not built')
+class ScriptTest(unittest.TestCase):
+	""" split.py parses lines alike with and without the extension """
+
+	def run_script(self, data, native):
+		# Without the extension for parsing only: db.py still formats
+		code = ('import db, runpy, sys\n'
+			'if not %r: sys.modules["_split"] = None\n'
+			'sys.argv = ["split.py", "--postgres"]\n'
+			'runpy.run_path("split.py", run_name="__main__")\n') % native
+		env = dict(os.environ, PYTHONPATH=os.pathsep.join(
+			[os.path.dirname(_split.__file__), os.environ.get('PYTHONPATH', '')]))
+		done = subprocess.run([sys.executable, '-c', code], input=data, cwd=HERE, env=env,
+			stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+		self.assertEqual(done.returncode, 0, done.stderr.decode())
+		return done.stdout.decode()
+
+	def test_stripped_lines(self):
+		# CRLF, and other whitespace around lines, as str.strip() removes it
+		ends = ['\r\n', '  \n', '\t\r\n', '\u00a0\n', '\u3000 \n', '\n']
+		lines = movies(200).decode().splitlines()
+		data = ''.join((' ' * (i % 2) + line + ends[i % len(ends)]) for i, line in enumerate(lines))
+		native = self.run_script(data.encode(), True)
+		self.assertEqual(native, self.run_script(data.encode(), False))
+		self.assertEqual(native.count('INSERT INTO movies'), len(lines))
+
+@unittest.skipUnless(_split, '_split extension not built')
+class LibraryTest(unittest.TestCase):
+	def test_exports(self):
+		library = os.path.join(os.path.dirname(_split.__file__), 'libsplit.so')
+		if not os.path.exists(library) or not shutil.which('nm'):
+			self.skipTest('libsplit.so or nm not found')
+		symbols = subprocess.run(['nm', '-D', '--defined-only', library],
+			stdout=subprocess.PIPE, check=True).stdout.decode().split()[2::3]
+		self.assertIn('split_version', symbols)
+		self.assertEqual([s for s in symbols if not s.startswith('split_')], [])
+
+if __name__ == '__main__':
+	unittest.main()
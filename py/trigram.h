@@ -0,0 +1,267 @@
+/*
+ * trigram.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __TRIGRAM_H__
+#define __TRIGRAM_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "snapshot.h"
+
+/**
+ * \brief Trigram index of a string column
+ *
+ * Inverted index of the trigrams (3 consecutive bytes, folded to lower case,
+ * see fold) of every value of a string column "x" to the rows they occur in,
+ * stored as snapshot columns next to it:
+ *
+ * - "x.grams": the sorted trigrams (u32)
+ * - "x.postings": a string column, value i being the posting list of trigram
+ *   i, i.e. its increasing rows as LEB128 varints of their differences
+ *
+ * A value containing a pattern contains every trigram of it: the candidate
+ * rows of a substring query (i.e. LIKE '%pattern%') are the intersection of
+ * the posting lists of its trigrams, and must still be verified. Lists are
+ * intersected from the shortest one on and intersection stops once there are
+ * few candidates left, as verifying them is then cheaper than decoding long
+ * lists.
+ */
+namespace trigram
+{
+	/**
+	 * Fold a byte of UTF-8 text to lower case, given the byte before it: the
+	 * ASCII letters and the capitals of the Latin-1 supplement (U+00C0 to
+	 * U+00DE but U+00D7, i.e. 0xC3 0x80-0x9E), which keeps byte offsets. Other
+	 * letters are left as they are: case-insensitive clients may only look up
+	 * text made of these (see RechFilmCC.py).
+	 */
+	inline char fold(char previous, char c)
+	{
+		if (c >= 'A' && c <= 'Z') return c + ('a' - 'A');
+		if (previous == '\xc3' && std::uint8_t(c) >= 0x80 && std::uint8_t(c) <= 0x9e && c != '\x97')
+			return c + 0x20;
+		return c;
+	}
+
+	inline std::string fold(std::string_view s)
+	{
+		std::string folded(s);
+		for (std::size_t i = 0; i < s.size(); i++) folded[i] = fold(i ? s[i - 1] : 0, s[i]);
+		return folded;
+	}
+
+	// Key of the trigram at a position of folded text
+	inline std::uint32_t key(const char* p)
+	{
+		return std::uint32_t(std::uint8_t(p[0])) << 16
+			| std::uint32_t(std::uint8_t(p[1])) << 8 | std::uint8_t(p[2]);
+	}
+
+	// Whether a value contains a pattern, already folded
+	inline bool contains(std::string_view value, std::string_view pattern)
+	{
+		if (pattern.size() > value.size()) return false;
+		for (std::size_t i = 0; i + pattern.size() <= value.size(); i++)
+		{
+			std::size_t j = 0;
+			while (j < pattern.size() && fold(i + j ? value[i + j - 1] : 0, value[i + j]) == pattern[j]) j++;
+			if (j == pattern.size()) return true;
+		}
+		return false;
+	}
+
+	// Append the rows of a posting list
+	inline void decode(std::string_view list, std::vector<std::uint32_t>& rows)
+	{
+		std::uint32_t row = 0;
+		for (std::size_t i = 0; i < list.size(); )
+		{
+			std::uint32_t delta = 0;
+			for (unsigned shift = 0; ; shift += 7)
+			{
+				const std::uint8_t byte = list[i++];
+				delta |= std::uint32_t(byte & 0x7f) << shift;
+				if (!(byte & 0x80)) break;
+			}
+			rows.push_back(row += delta);
+		}
+	}
+
+	/**
+	 * Intersect sorted arrays of distinct values into out, which may be a (but
+	 * not b), and return the size of the intersection. Blocks of 4 values of a
+	 * are compared with the 4 rotations of a block of b at once (SSE2), then the
+	 * block with the smaller last value is passed.
+	 */
+	inline std::size_t intersect(const std::uint32_t* a, std::size_t na,
+								 const std::uint32_t* b, std::size_t nb, std::uint32_t* out)
+	{
+		std::size_t i = 0, j = 0, k = 0;
+#ifdef __SSE2__
+		while (i + 4 <= na && j + 4 <= nb)
+		{
+			const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+				vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+			const __m128i equal = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi32(va, vb),
+					_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+				_mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+					_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+
+			// Read the last values first, as out may overwrite a
+			const std::uint32_t last_a = a[i + 3], last_b = b[j + 3];
+			for (int mask = _mm_movemask_ps(_mm_castsi128_ps(equal)); mask; mask &= mask - 1)
+				out[k++] = a[i + __builtin_ctz(mask)];
+
+			if (last_a <= last_b) i += 4;
+			if (last_b <= last_a) j += 4;
+		}
+#endif
+		while (i < na && j < nb)
+		{
+			if (a[i] < b[j]) i++;
+			else if (b[j] < a[i]) j++;
+			else
+			{
+				out[k++] = a[i++];
+				j++;
+			}
+		}
+		return k;
+	}
+}
+
+/// Trigram index builder of a string column
+struct trigram_builder
+{
+	std::vector<std::uint32_t> grams;
+	snapshot_builder::strings postings;
+
+	explicit trigram_builder(const snapshot_builder::strings& column);
+};
+
+inline trigram_builder::trigram_builder(const snapshot_builder::strings& column)
+{
+	// (trigram, row) pairs, in row order
+	std::vector<std::uint64_t> pairs;
+	pairs.reserve(column.data.size());
+	std::string folded;
+	for (std::uint32_t row = 0; row + 1 < column.offsets.size(); row++)
+	{
+		const std::string_view value = std::string_view(column.data).substr(column.offsets[row],
+			column.offsets[row + 1] - column.offsets[row]);
+		folded.resize(value.size());
+		for (std::size_t i = 0; i < value.size(); i++) folded[i] = trigram::fold(i ? value[i - 1] : 0, value[i]);
+		for (std::size_t i = 0; i + 3 <= folded.size(); i++)
+			pairs.push_back(std::uint64_t(trigram::key(folded.data() + i)) << 32 | row);
+	}
+
+	// Stable radix sort on the 24 trigram bits, which keeps rows in order
+	std::vector<std::uint64_t> sorted(pairs.size());
+	for (const unsigned shift: { 32u, 44u })
+	{
+		std::vector<std::size_t> start(4097, 0);
+		for (const std::uint64_t p: pairs) start[(p >> shift & 0xfff) + 1]++;
+		for (std::size_t i = 1; i < start.size(); i++) start[i] += start[i - 1];
+		for (const std::uint64_t p: pairs) sorted[start[p >> shift & 0xfff]++] = p;
+		pairs.swap(sorted);
+	}
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+	for (std::size_t i = 0; i < pairs.size(); )
+	{
+		const std::uint32_t gram = pairs[i] >> 32;
+		std::uint32_t previous = 0;
+		for (; i < pairs.size() && pairs[i] >> 32 == gram; i++)
+		{
+			std::uint32_t delta = std::uint32_t(pairs[i]) - previous;
+			previous = std::uint32_t(pairs[i]);
+			for (; delta >= 0x80; delta >>= 7) postings.data += char(delta | 0x80);
+			postings.data += char(delta);
+		}
+		grams.push_back(gram);
+		postings.offsets.push_back(postings.data.size());
+	}
+}
+
+/// Trigram index reader over a snapshot
+class trigram_index
+{
+public:
+	// Index of a string column, or none if the snapshot has no index of it
+	trigram_index(const snapshot& s, const std::string& column)
+	{
+		if (!s.has(column + ".grams")) return;
+		grams = s.column<std::uint32_t>(column + ".grams");
+		postings = s.strings(column + ".postings");
+	}
+
+	explicit operator bool () const { return grams.size; }
+
+	// Set the candidate rows of a folded pattern, in order, or return false
+	// if the pattern is shorter than a trigram
+	bool candidates(std::string_view pattern, std::vector<std::uint32_t>& rows) const;
+
+private:
+	array_view<std::uint32_t> grams;
+	string_column postings;
+};
+
+inline bool trigram_index::candidates(std::string_view pattern, std::vector<std::uint32_t>& rows) const
+{
+	rows.clear();
+	if (pattern.size() < 3) return false;
+
+	// Posting lists of the distinct trigrams, shortest first
+	std::vector<std::string_view> lists;
+	for (std::size_t i = 0; i + 3 <= pattern.size(); i++)
+	{
+		const std::uint32_t key = trigram::key(pattern.data() + i);
+		const auto g = std::lower_bound(grams.begin(), grams.end(), key);
+		if (g == grams.end() || *g != key) return true;
+		lists.push_back(postings[g - grams.begin()]);
+	}
+	std::sort(lists.begin(), lists.end(), [](std::string_view a, std::string_view b)
+		{ return a.size() < b.size() || (a.size() == b.size() && a.data() < b.data()); });
+	lists.erase(std::unique(lists.begin(), lists.end(),
+		[](std::string_view a, std::string_view b) { return a.data() == b.data(); }), lists.end());
+
+	trigram::decode(lists[0], rows);
+	std::vector<std::uint32_t> next;
+	for (std::size_t i = 1; i < lists.size() && rows.size() > 32; i++)
+	{
+		next.clear();
+		trigram::decode(lists[i], next);
+		rows.resize(trigram::intersect(rows.data(), rows.size(), next.data(), next.size(), rows.data()));
+	}
+	return true;
+}
+
+
+#endif /* if __TRIGRAM_H__ */
@@ -0,0 +1,154 @@
+/*
+ * validate.h
+ *
+ * Copyright 2019 Vincent Cadet <vincent.cadet@hepl.be>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef __VALIDATE_H__
+#define __VALIDATE_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "output.h"
+
+/**
+ * \brief UTF-8 string lengths
+ *
+ * VARCHAR(n) columns hold n characters, i.e. code points, whereas values are
+ * sized in bytes: a value of at most n bytes fits anyway, and longer ones
+ * need counting.
+ */
+namespace utf8
+{
+	// Number of code points, i.e. bytes but continuation bytes (10xxxxxx),
+	// counted 16 bytes at a time with SSE2
+	inline std::size_t length(std::string_view s)
+	{
+		std::size_t continuations = 0, i = 0;
+#ifdef __SSE2__
+		// Continuation bytes are those below -64 as signed bytes
+		const __m128i bound = _mm_set1_epi8(-64);
+		for (; i + 16 <= s.size(); i += 16)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + i));
+			continuations += __builtin_popcount(_mm_movemask_epi8(_mm_cmplt_epi8(v, bound)));
+		}
+#endif
+		for (; i < s.size(); i++) continuations += (std::uint8_t(s[i]) & 0xc0) == 0x80;
+		return s.size() - continuations;
+	}
+
+	// Number of bytes of the first n code points
+	inline std::size_t prefix(std::string_view s, std::size_t n)
+	{
+		std::size_t i = 0;
+		for (; i < s.size(); i++)
+			if ((std::uint8_t(s[i]) & 0xc0) != 0x80 && n-- == 0) break;
+		return i;
+	}
+}
+
+/**
+ * \brief Schema validation settings and counters
+ *
+ * Values which the server would reject or truncate are either fixed, i.e.
+ * truncated to their column length or nulled if not members of their ENUM,
+ * or their whole input line is rejected: written to the reject file, if any,
+ * and skipped. Lines whose values cannot be fixed (e.g. empty required
+ * values) are always rejected.
+ *
+ * Counters are plain integers, one instance per thread (see stats).
+ */
+struct validation
+{
+	// Fix values rather than reject their line
+	bool fix = false;
+
+	// Rejected lines output, if any
+	writer* rejects = nullptr;
+
+	// Counters of a column: its table and column names are static schema
+	// strings, hence told apart by address
+	struct column
+	{
+		const char* table;
+		std::size_t index;
+		const char* name;
+		std::uint64_t truncated, nulled, rejected;
+	};
+
+	std::vector<column> columns;
+	std::uint64_t lines_rejected = 0;
+
+	// Counters of column i of a table, added upon first use
+	template <typename Table>
+	column& at(std::size_t i) { return find(Table::name, i, Table::columns[i]); }
+
+	column& find(const char* table, std::size_t index, const char* name)
+	{
+		for (auto& c: columns)
+			if (c.table == table && c.index == index) return c;
+		return columns.emplace_back(column{ table, index, name, 0, 0, 0 });
+	}
+
+	void merge(const validation&);
+
+	// Print the counters of every column, if any
+	void print(std::ostream&) const;
+};
+
+inline void validation::merge(const validation& v)
+{
+	for (const auto& c: v.columns)
+	{
+		column& mine = find(c.table, c.index, c.name);
+		mine.truncated += c.truncated;
+		mine.nulled += c.nulled;
+		mine.rejected += c.rejected;
+	}
+	lines_rejected += v.lines_rejected;
+}
+
+inline void validation::print(std::ostream& out) const
+{
+	char line[160];
+	std::snprintf(line, sizeof line, "validation: %llu lines rejected\n",
+		static_cast<unsigned long long>(lines_rejected));
+	out << line;
+	for (const auto& c: columns)
+	{
+		char name[64];
+		std::snprintf(name, sizeof name, "%s.%s", c.table, c.name);
+		std::snprintf(line, sizeof line, "  %-26s %10llu truncated %10llu nulled %10llu rejected\n",
+			name, static_cast<unsigned long long>(c.truncated),
+			static_cast<unsigned long long>(c.nulled), static_cast<unsigned long long>(c.rejected));
+		out << line;
+	}
+}
+
+
+#endif /* if __VALIDATE_H__ */